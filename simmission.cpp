@@ -0,0 +1,141 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * Run missions against the simulated REGBOT (USim) a number of times,
+ * and report the (simulated) mission completion time.
+ * usage: simmission [-w world.txt] [-f fromMission] [-t toMission] [-n runs] [-s timescale] [-v]
+ *                   [-o trace.bin] [-p trace.bin]
+ * timescale 0 (default) runs as fast as possible, 1 is real-time.
+ * Default is mission 1 in the default world; simworld.txt is for missions 1 and 2,
+ * simpass.txt for mission 3 and simfollow.txt for mission 4.
+ * -v prints the commands and the simulator status at the end of a run,
+ * -o records the bridge traffic of the (last) run,
+ * -p replays a recorded traffic trace (from the robot or from -o) instead
+ * of simulating, and reports command differences and timing. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "umission.h"
+#include "usim.h"
+
+int main(int argc, char **argv)
+{
+  const char *world = NULL;
+  int fromMission = 1, toMission = 1, runs = 1;
+  float timeScale = 0;
+  bool verbose = false;
+  const char *recordName = NULL;
+  const char *replayName = NULL;
+  UTraffic trace;
+  // max simulated time for one run
+  const double maxSimTime = 300;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:f:t:n:s:vo:p:h")) != -1)
+  {
+    switch (opt)
+    {
+    case 'w': world = optarg; break;
+    case 'f': fromMission = atoi(optarg); break;
+    case 't': toMission = atoi(optarg); break;
+    case 'n': runs = atoi(optarg); break;
+    case 's': timeScale = atof(optarg); break;
+    case 'v': verbose = true; break;
+    case 'o': recordName = optarg; break;
+    case 'p': replayName = optarg; break;
+    default:
+      printf("usage: %s [-w world.txt] [-f fromMission] [-t toMission] [-n runs] [-s timescale] [-v]"
+             " [-o trace.bin] [-p trace.bin]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (replayName != NULL)
+  { // one run, with the recorded inputs
+    if (trace.load(replayName) < 0)
+      return 1;
+    runs = 1;
+  }
+  double tMin = 1e9, tMax = 0, tSum = 0;
+  int failed = 0;
+  // runs per minute in wall-clock time, also when the simulation is faster than the clock resolution
+  timespec t0;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int r = 0; r < runs; r++)
+  {
+    USim sim;
+    if (world != NULL and not sim.loadWorld(world))
+      return 1;
+    sim.timeScale = timeScale;
+    sim.verbose = verbose;
+    if (replayName != NULL)
+      sim.replay = &trace;
+    UMission mission(NULL, NULL);
+    mission.setSimulator(&sim);
+    mission.fromMission = fromMission;
+    mission.toMission = toMission;
+    if (recordName != NULL and r == runs - 1)
+      mission.recordTraffic(recordName);
+    mission.start();
+    while (not mission.finished and sim.simTime < maxSimTime and not trace.replayEnded())
+      usleep(1000);
+    double ts = sim.simTime;
+    mission.stop();
+    if (replayName != NULL)
+    {
+      trace.printStatus();
+      // differing, missing or extra commands fail the replay
+      return trace.replayOK() ? 0 : 1;
+    }
+    if (sim.errorCnt > 0)
+    { // the simulated mission did not run as on the REGBOT
+      printf("# run %d: %d mission lines with unknown conditions\n", r + 1, sim.errorCnt);
+      failed++;
+      continue;
+    }
+    if (ts >= maxSimTime)
+    {
+      printf("# run %d: timeout in mission %d state %d\n", r + 1, mission.mission, mission.missionState);
+      sim.printStatus();
+      failed++;
+      continue;
+    }
+    printf("# run %d: missions %d..%d finished in %.3f s\n", r + 1, fromMission, toMission, ts);
+    if (verbose)
+      sim.printStatus();
+    if (ts < tMin)
+      tMin = ts;
+    if (ts > tMax)
+      tMax = ts;
+    tSum += ts;
+  }
+  timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double dt = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+  int ok = runs - failed;
+  if (ok > 0)
+    printf("# %d runs (%d failed), mission time min %.3f, avg %.3f, max %.3f s, %.0f runs/minute\n",
+           runs, failed, tMin, tSum / ok, tMax, runs / dt * 60);
+  else
+    printf("# all %d runs failed\n", runs);
+  return failed;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+/**
+ * Convert a telemetry recording (telemetry_[date].bin) to CSV files,
+ * one file per data stream.
+ * usage: telemetry2csv telemetry_[date].bin [...] */
+
+#include <cstdio>
+#include "utelemetry.h"
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    printf("usage: %s telemetry_file.bin [...]\n", argv[0]);
+    printf("makes telemetry_file_[stream].csv for each stream in the file\n");
+    return 1;
+  }
+  int err = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    int n = UTelemetry::exportCsv(argv[i]);
+    if (n < 0)
+      err++;
+    else
+      printf("%s: %d samples converted\n", argv[i], n);
+  }
+  return err;
+}
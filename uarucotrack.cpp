@@ -0,0 +1,218 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "uarucotrack.h"
+#include "utime.h"
+
+UArUcoTracker::UArUcoTracker(int dictionary)
+{
+  dict = cv::aruco::getPredefinedDictionary(dictionary);
+  params = cv::aruco::DetectorParameters::create();
+  // corners are refined at full resolution, not in the reduced image
+  params->cornerRefinementMethod = cv::aruco::CORNER_REFINE_NONE;
+}
+
+void UArUcoTracker::reset()
+{
+  lock_guard<mutex> guard(lock);
+  tracks.clear();
+  lost = false;
+  lastFrame = -1;
+}
+
+void UArUcoTracker::search(const cv::Mat &im, const cv::Rect &roi, float f,
+                           vector<int> &ids, vector<vector<cv::Point2f>> &corners)
+{
+  roiIds.clear();
+  roiCorners.clear();
+  cv::aruco::detectMarkers(im(roi), dict, roiCorners, roiIds, params);
+  for (size_t i = 0; i < roiIds.size(); i++)
+  {
+    bool known = false;
+    for (int id : ids)
+      known |= id == roiIds[i];
+    if (known)
+      // found by an overlapping region too
+      continue;
+    for (auto &c : roiCorners[i])
+    { // to full resolution (pixel centres)
+      c.x = (c.x + roi.x + 0.5) * f - 0.5;
+      c.y = (c.y + roi.y + 0.5) * f - 0.5;
+    }
+    ids.push_back(roiIds[i]);
+    corners.push_back(roiCorners[i]);
+  }
+}
+
+void UArUcoTracker::refine(const cv::Mat &full, vector<cv::Point2f> &corners)
+{
+  const int m = refineWin + 2;
+  const cv::Rect frame(0, 0, full.cols, full.rows);
+  static const cv::TermCriteria criteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 20, 0.05);
+  vector<cv::Point2f> pt(1);
+  for (auto &c : corners)
+  { // grey window around this corner only
+    cv::Rect w = cv::Rect(int(c.x) - m, int(c.y) - m, 2 * m + 1, 2 * m + 1) & frame;
+    if (w.width < 2 * m + 1 or w.height < 2 * m + 1)
+      // too close to the image edge
+      continue;
+    cv::cvtColor(full(w), grey, cv::COLOR_BGR2GRAY);
+    pt[0] = cv::Point2f(c.x - w.x, c.y - w.y);
+    cv::cornerSubPix(grey, pt, cv::Size(refineWin, refineWin), cv::Size(-1, -1), criteria);
+    c = cv::Point2f(pt[0].x + w.x, pt[0].y + w.y);
+  }
+}
+
+int UArUcoTracker::process(UImagePyramid &pyr, int frame, const cv::Mat &cameraMatrix, const cv::Mat &distortion,
+                           const cv::Mat &cam2robot, vector<UArUcoMarker> &result)
+{
+  lock_guard<mutex> guard(lock);
+  UTime t;
+  t.now();
+  result.clear();
+  frameCnt++;
+  cv::Mat im = pyr.get(searchLevel);
+  if (im.empty())
+    // no frame
+    return 0;
+  const float f = 1.0 / UImagePyramid::scaleOf(searchLevel);
+  const cv::Rect imRect(0, 0, im.cols, im.rows);
+  vector<int> ids;
+  vector<vector<cv::Point2f>> corners;
+  bool full = lost or tracks.empty() or frame - lastFullFrame >= fullSearchEvery;
+  if (full)
+  {
+    search(im, imRect, f, ids, corners);
+    lastFullFrame = frame;
+    fullCnt++;
+  }
+  else
+  { // search predicted regions only
+    for (auto &tr : tracks)
+    {
+      Track &k = tr.second;
+      float dt = frame - k.frame;
+      cv::Point2f mv = k.vel * dt;
+      float x0 = 1e9, y0 = 1e9, x1 = -1e9, y1 = -1e9;
+      for (auto &c : k.corners)
+      {
+        x0 = fminf(x0, c.x + mv.x);
+        y0 = fminf(y0, c.y + mv.y);
+        x1 = fmaxf(x1, c.x + mv.x);
+        y1 = fmaxf(y1, c.y + mv.y);
+      }
+      // margin relative to marker size in image
+      float mg = roiFactor * fmaxf(x1 - x0, y1 - y0) + 4 * f;
+      cv::Rect roi = cv::Rect((x0 - mg) / f, (y0 - mg) / f, (x1 - x0 + 2 * mg) / f, (y1 - y0 + 2 * mg) / f) & imRect;
+      if (roi.width > 8 and roi.height > 8)
+        search(im, roi, f, ids, corners);
+    }
+    trackCnt++;
+  }
+  // tracked markers not found, then full search in next frame
+  lost = false;
+  for (auto &tr : tracks)
+  {
+    bool found = false;
+    for (int id : ids)
+      found |= id == tr.first;
+    if (not found and tr.second.frame == lastFrame)
+    {
+      lost = true;
+      lostCnt++;
+    }
+  }
+  if (not ids.empty())
+  {
+    cv::Mat fullIm = pyr.get(0);
+    for (auto &c : corners)
+      refine(fullIm, c);
+    vector<cv::Vec3d> rvecs, tvecs;
+    cv::aruco::estimatePoseSingleMarkers(corners, markerSize, cameraMatrix, distortion, rvecs, tvecs);
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      UArUcoMarker mk;
+      mk.id = ids[i];
+      for (int j = 0; j < 4; j++)
+        mk.corners[j] = corners[i][j];
+      mk.rvec = rvecs[i];
+      mk.tvec = tvecs[i];
+      mk.tracked = not full;
+      // position in robot coordinates
+      cv::Mat pc = (cv::Mat_<float>(4, 1) << mk.tvec[0], mk.tvec[1], mk.tvec[2], 1);
+      cv::Mat pr = cam2robot * pc;
+      mk.x = pr.at<float>(0, 0);
+      mk.y = pr.at<float>(1, 0);
+      mk.z = pr.at<float>(2, 0);
+      mk.distance = hypot(mk.x, mk.y);
+      mk.angle = atan2(mk.y, mk.x) * 180 / M_PI;
+      // marker normal (marker z-axis) in robot coordinates
+      cv::Mat rot;
+      cv::Rodrigues(mk.rvec, rot);
+      cv::Mat nc = (cv::Mat_<float>(4, 1) << rot.at<double>(0, 2), rot.at<double>(1, 2), rot.at<double>(2, 2), 0);
+      cv::Mat nr = cam2robot * nc;
+      mk.heading = atan2(nr.at<float>(1, 0), nr.at<float>(0, 0));
+      result.push_back(mk);
+      // update track
+      auto it = tracks.find(mk.id);
+      Track k;
+      k.frame = frame;
+      for (int j = 0; j < 4; j++)
+        k.corners[j] = mk.corners[j];
+      if (it != tracks.end() and frame > it->second.frame)
+      { // corner motion per frame (mean of corners)
+        cv::Point2f d(0, 0);
+        for (int j = 0; j < 4; j++)
+          d += k.corners[j] - it->second.corners[j];
+        k.vel = d * (0.25 / (frame - it->second.frame));
+      }
+      else
+        k.vel = cv::Point2f(0, 0);
+      tracks[mk.id] = k;
+    }
+  }
+  // forget markers not seen for a while
+  for (auto it = tracks.begin(); it != tracks.end();)
+  {
+    if (frame - it->second.frame > fullSearchEvery)
+      it = tracks.erase(it);
+    else
+      ++it;
+  }
+  lastFrame = frame;
+  markerCnt += result.size();
+  time += t.getTimePassed();
+  return result.size();
+}
+
+void UArUcoTracker::printStatus()
+{
+  lock_guard<mutex> guard(lock);
+  printf("# ArUco tracker: marker %.3fm, search level %d, full search every %d frames\n",
+         markerSize, searchLevel, fullSearchEvery);
+  printf("#   %d frames (%d full search, %d tracking, %d lost), %d markers, %.2f ms per frame\n",
+         frameCnt, fullCnt, trackCnt, lostCnt, markerCnt, frameCnt > 0 ? time / frameCnt * 1000 : 0);
+  for (auto &tr : tracks)
+    printf("#   tracking marker %d (last frame %d)\n", tr.first, tr.second.frame);
+}
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef UARUCOTRACK_H
+#define UARUCOTRACK_H
+
+#include <mutex>
+#include <vector>
+#include <map>
+#include <opencv2/core/core.hpp>
+#include <opencv2/aruco.hpp>
+#include "uimagepyramid.h"
+
+using namespace std;
+
+/**
+ * An ArUco marker found in an image */
+struct UArUcoMarker
+{
+  int id = -1;
+  /// corners at full image resolution (sub-pixel refined)
+  cv::Point2f corners[4];
+  /// marker pose in camera coordinates (x=right, y=down, z=fwd) [rad, m]
+  cv::Vec3d rvec, tvec;
+  /// marker centre in robot coordinates (x=fwd, y=left, z=up) [m]
+  float x = 0, y = 0, z = 0;
+  /// distance from robot centre [m] and angle [degrees, positive is left]
+  float distance = 0, angle = 0;
+  /// direction of marker normal (out of marker surface) relative to robot heading [rad]
+  float heading = 0;
+  /// found in a predicted region (not by a full search)
+  bool tracked = false;
+};
+
+/**
+ * ArUco detection on a reduced image (pyramid level) with corner refinement
+ * at full resolution (in small windows around each corner only).
+ * Markers found in the last frame are tracked: the search is limited to a
+ * region around the predicted marker position, a full (reduced) image search
+ * is done every fullSearchEvery frames, or when a tracked marker is lost.
+ * This is cheap enough to run on every frame. */
+class UArUcoTracker
+{
+public:
+  /// marker side length [m]
+  float markerSize = 0.1;
+  /// pyramid level for the candidate search (1 is half size)
+  int searchLevel = 1;
+  /// full search every this many frames (else tracking only)
+  int fullSearchEvery = 10;
+  /// region around predicted marker is this times marker size (in pixels)
+  float roiFactor = 1.0;
+  /// sub-pixel corner refinement window (half size) [pixels]
+  int refineWin = 5;
+
+public:
+  /**
+   * Constructor
+   * \param dictionary is the ArUco dictionary, e.g. cv::aruco::DICT_4X4_100 */
+  UArUcoTracker(int dictionary = cv::aruco::DICT_4X4_100);
+  /**
+   * Find markers in the current frame
+   * \param pyr is the image pyramid of the current frame
+   * \param frame is the image number
+   * \param cameraMatrix, distortion is the camera calibration (full resolution)
+   * \param cam2robot is the 4x4 camera to robot coordinate transformation
+   * \param result is the markers found (cleared first)
+   * \returns number of markers found */
+  int process(UImagePyramid &pyr, int frame, const cv::Mat &cameraMatrix, const cv::Mat &distortion,
+              const cv::Mat &cam2robot, vector<UArUcoMarker> &result);
+  /** forget tracked markers, so next frame is a full search */
+  void reset();
+  /** print status */
+  void printStatus();
+
+private:
+  /// a marker found in earlier frames
+  struct Track
+  {
+    cv::Point2f corners[4];
+    /// corner motion from the frame before [pixels per frame]
+    cv::Point2f vel;
+    int frame;
+  };
+  /**
+   * Detect markers in a part of the search level image
+   * \param im is the search level image, roi is the part to search (search level pixels)
+   * \param f is the factor from search level to full resolution
+   * adds markers (with full resolution corners) to ids and corners */
+  void search(const cv::Mat &im, const cv::Rect &roi, float f,
+              vector<int> &ids, vector<vector<cv::Point2f>> &corners);
+  /** refine corners in full resolution windows */
+  void refine(const cv::Mat &full, vector<cv::Point2f> &corners);
+  //
+  mutex lock;
+  cv::Ptr<cv::aruco::Dictionary> dict;
+  cv::Ptr<cv::aruco::DetectorParameters> params;
+  map<int, Track> tracks;
+  int lastFullFrame = -1000;
+  int lastFrame = -1;
+  bool lost = false;
+  /// reused work images and lists
+  cv::Mat grey;
+  vector<int> roiIds;
+  vector<vector<cv::Point2f>> roiCorners;
+  /// statistics
+  int frameCnt = 0, fullCnt = 0, trackCnt = 0, lostCnt = 0, markerCnt = 0;
+  float time = 0;
+};
+
+#endif
@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UBALLWORKSPACE_H
+#define UBALLWORKSPACE_H
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+/**
+ * Buffers for ball detection, allocated once for the frame size,
+ * and reused for every detection (buffers are never written in place,
+ * as in-place filters allocate a temporary copy).
+ * The structuring elements for all (odd) kernel sizes are made at allocation.
+ * A buffer that is reallocated by a detection is counted, so that steady
+ * state should show no new allocations (OpenCV internal buffers,
+ * e.g. in HoughCircles, are not included). */
+struct UBallWorkspace
+{
+  const static int MAX_KERNEL = 15;
+  /// buffers: blurred image, HSV, colour masks, combined mask, opened and smoothed mask
+  enum {B_BLUR, B_HSV, B_LOWER, B_UPPER, B_MASK, B_OPEN, B_SMOOTH, BUF_CNT};
+  cv::Mat buf[BUF_CNT];
+  /// views of the buffers for the current detection (region of interest)
+  cv::Mat view[BUF_CNT];
+  /// coarse (pyramid level) search for red pixels
+  cv::Mat coarseHsv, coarseLower, coarseUpper, coarseMask;
+  std::vector<cv::Point> coarsePixels;
+  /// structuring element for kernel size n (odd n only)
+  cv::Mat element[MAX_KERNEL + 1];
+  /// found circles
+  std::vector<cv::Vec3f> circles;
+  /// allocation statistics
+  int allocCnt = 0;
+  int detectCnt = 0;
+  /// detections stopped by coarse search, and area searched at full resolution
+  int coarseRejectCnt = 0;
+  double fullArea = 0;
+  size_t bytes = 0;
+
+  /**
+   * Allocate buffers for this image size */
+  void allocate(int rows, int cols)
+  {
+    for (int i = 0; i < BUF_CNT; i++)
+      buf[i].create(rows, cols, i < B_LOWER ? CV_8UC3 : CV_8UC1);
+    for (int n = 1; n <= MAX_KERNEL; n += 2)
+      element[n] = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(n, n));
+    circles.reserve(32);
+    coarsePixels.reserve(rows * cols / 64);
+    bytes = size_t(rows) * cols * (3 + 3 + 5);
+    allocCnt++;
+  }
+  /**
+   * Make buffer views for a region of an image of this size.
+   * Buffers are (re)allocated if the image size has changed */
+  void makeViews(int rows, int cols, const cv::Rect &roi)
+  {
+    if (buf[0].rows != rows or buf[0].cols != cols)
+      allocate(rows, cols);
+    fullArea += roi.area();
+    for (int i = 0; i < BUF_CNT; i++)
+    {
+      view[i] = buf[i](roi);
+      data[i] = view[i].data;
+    }
+    circlesCap = circles.capacity();
+    circles.clear();
+  }
+  /**
+   * Structuring element for a kernel size (even size uses next odd) */
+  cv::Mat &getElement(int n)
+  {
+    return element[std::max(1, std::min(n, (int)MAX_KERNEL)) | 1];
+  }
+  /** count buffers reallocated by the detection (since makeViews) */
+  void countAllocations()
+  {
+    for (int i = 0; i < BUF_CNT; i++)
+      if (view[i].data != data[i])
+        allocCnt++;
+    if (circles.capacity() != circlesCap)
+      allocCnt++;
+    detectCnt++;
+  }
+  void printStatus()
+  {
+    printf("# ball detection workspace: %.1f MB, %d detections, %d buffer allocations\n",
+           bytes / 1e6, detectCnt, allocCnt);
+    if (detectCnt > 0 and buf[0].rows > 0)
+      printf("#   %d rejected by coarse search, %.0f%% of image searched at full resolution\n",
+             coarseRejectCnt, fullArea / detectCnt / (buf[0].rows * buf[0].cols) * 100);
+  }
+
+private:
+  const void *data[BUF_CNT];
+  size_t circlesCap = 0;
+};
+
+#endif
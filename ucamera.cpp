@@ -70,8 +70,11 @@ void UCamera::stop()
 void UCamera::printStatus()
 {
   printf("# ------------ camera ------------\n");
-  printf("# camera open=%d, frame number %d\n", cameraOpen, imageNumber);
+  printf("# camera open=%d, ready=%d (%d warm-up frames in %.2f s), frame number %d\n",
+         cameraOpen, cameraReady, warmUpFrames, warmUpTime, imageNumber);
   printf("# focal length = %.0f pixels\n", cameraMatrix.at<double>(0, 0));
+  printf("# vision jobs: %d submitted, %d waiting, %d dropped (queue full)\n",
+         jobCnt, (int)jobs.size(), jobDroppedCnt);
   printf("# Camera position (%.3fx, %.3fy, %.3fz) [m]\n", camPos[0], camPos[1], camPos[2]);
   printf("# Camera rotation (%.1froll, %.1fpitch, %.1fpan) [degrees]\n",
          camRot[0] * 180 / M_PI,
@@ -84,6 +87,20 @@ void UCamera::printStatus()
          camDev.get(CV_CAP_PROP_FPS));
 #endif
   arUcos->printStatus();
+  arucoTracker->printStatus();
+  lineAhead->printStatus();
+  printf("# scene change: %d tests, %.2f ms per frame, last difference %.1f (limit %.1f)\n",
+         sceneTestCnt, sceneTestTime * 1000 / max(imageNumber, 1), lastSceneDiff, sceneMaxDiff);
+  printf("#   ball result reused %d times, detected %d times\n", ballCache.hits, ballCache.misses);
+  printf("#   object results reused %d times, detected %d times\n", objectsCache.hits, objectsCache.misses);
+  pyramid.printStatus();
+  ballWs.printStatus();
+  detector->printStatus();
+  recorder->printStatus();
+  quality->printStatus();
+  UTime t;
+  t.now();
+  objects->printStatus(t.getDecSec());
 }
 
 //////////////////////////////////////////////////
@@ -93,11 +110,20 @@ UCamera::UCamera(UBridge *reg)
 {
   th1 = NULL;
   th1stop = false;
-  saveImage = false;
-  doObjectDetection = false;
   bridge = reg;
   arUcos = new ArUcoVals(this);
+  arucoTracker = new UArUcoTracker();
+  lineAhead = new ULineAhead();
+  objects = new UObjectMap();
+  detector = new UObjectDetector();
+  recorder = new UFlightRecorder();
+  quality = new UVisionQuality();
   cameraOpen = setupCamera();
+#ifdef raspicam_CV_LIBS
+  if (cameraOpen)
+    // ball detection buffers are allocated now, and then reused
+    ballWs.allocate(camDev.get(CV_CAP_PROP_FRAME_HEIGHT), camDev.get(CV_CAP_PROP_FRAME_WIDTH));
+#endif
   // initialize coordinate conversion
   makeCamToRobotTransformation();
   if (cameraOpen)
@@ -132,12 +158,13 @@ void UCamera::openCamLog()
     fprintf(logImg, "%% 1 Time [sec]\n");
     fprintf(logImg, "%% 2 Regbot time [sec]\n");
     fprintf(logImg, "%% 3 image number\n");
-    fprintf(logImg, "%% 4 save image\n");
-    fprintf(logImg, "%% 5 do ArUco analysis\n");
+    fprintf(logImg, "%% 4 vision jobs waiting\n");
+    fprintf(logImg, "%% 5 ball servo active\n");
     fflush(logImg);
   }
   else
     printf("#UCamera:: Failed to open image logfile\n");
+  quality->openLog(date);
   //
 }
 
@@ -145,6 +172,7 @@ void UCamera::closeCamLog()
 {
   if (logImg != NULL)
     fclose(logImg);
+  quality->closeLog();
 }
 
 // void UCamera::closeArucoLog()
@@ -160,6 +188,14 @@ UCamera::~UCamera()
   printf("#UCamera::destructor - closing\n");
   closeCamLog();
   stop();
+  // no one should wait for a job that will never be processed
+  finishJobs(UVisionResult::CANCELLED);
+  delete arucoTracker;
+  delete lineAhead;
+  delete objects;
+  delete detector;
+  delete recorder;
+  delete quality;
 }
 
 //////////////////////////////////////////////////
@@ -190,9 +226,12 @@ int getAverageIntensity(cv::Mat im)
 {
   int sum = 0; // of red
   int n = 0;
-  for (int row = 2; row < im.rows; row += 55)
+  // about 18 rows and 85 columns, so any pyramid level can be used
+  int rowStep = max(1, im.rows / 18);
+  int colStep = max(1, im.cols / 85);
+  for (int row = 2; row < im.rows; row += rowStep)
   {
-    for (int col = 2; col < im.cols; col += 15)
+    for (int col = 2; col < im.cols; col += colStep)
     {
       n++;
       cv::Vec3b pix = im.at<cv::Vec3b>(row, col);
@@ -203,6 +242,31 @@ int getAverageIntensity(cv::Mat im)
   return sum / n;
 }
 
+void UCamera::warmUp(cv::Mat &image)
+{
+  UTime t;
+  t.now();
+  int last = -1;
+  int stable = 0;
+  while (warmUpFrames < 30 and stable < 3 and not th1stop)
+  {
+    capture(image);
+    warmUpFrames++;
+    if (image.rows > 10 and image.cols > 10)
+    { // stable is within 2% (or 2 values)
+      int avg = getAverageIntensity(image);
+      if (last >= 0 and abs(avg - last) <= max(2, last / 50))
+        stable++;
+      else
+        stable = 0;
+      last = avg;
+    }
+  }
+  warmUpTime = t.getTimePassed();
+  cameraReady = true;
+  printf("# UCamera:: camera ready after %d frames (%.2f s)\n", warmUpFrames, warmUpTime);
+}
+
 //////////////////////////////////////////////////
 
 /**
@@ -220,19 +284,20 @@ void UCamera::run()
               //   printf("# camera thread started\n");
   UTime t;
   float dt = 0;
-  saveImage = false;
-  doObjectDetection = false;
-  doArUcoAnalysis = false;
   doArUcoLoopTest = false;
-  distanceToObject = 0.0;
-  angleToObject = 0.0;
   int arucoLoop = 100;
+  if (cameraOpen)
+    warmUp(im);
   while (not th1stop)
   {
     if (cameraOpen)
     {
       // capture RGB image to a Mat structure
       imTime = capture(im);
+      // robot pose at (close to) image time
+      imPose[0] = bridge->pose->x;
+      imPose[1] = bridge->pose->y;
+      imPose[2] = bridge->pose->h;
       if (im.rows > 10 and im.cols > 10)
       { // there is an image
         imageNumber++;
@@ -241,33 +306,53 @@ void UCamera::run()
           fprintf(logImg, "%ld.%03ld %.3f %d %d %d\n",
                   imTime.getSec(), imTime.getMilisec(),
                   bridge->info->regbotTime, imageNumber,
-                  saveImage, doArUcoAnalysis);
+                  (int)jobs.size(), doBallServo);
         }
+        // reduced images are made when requested by a detector
+        pyramid.setFrame(im, imageNumber);
         // test function to access pixel values
-        //imgAverage = getAverageIntensity(im);
+        //imgAverage = getAverageIntensity(pyramid.get(3));
         //
-        // test for required actions
-        if (saveImage)
-        { // save image as PNG file (takes lots of time to compress and save to flash)
-          //printf("# saving - avg=%d\n", imgAverage);
-          saveImageAsPng(im);
-          printf("Image saved\n");
-          //
-          saveImage = false;
-        }
-        if (doObjectDetection)
-        {
-          processBallDetection(im);
-          doObjectDetection = false;
-        }
-        if (doArUcoAnalysis)
-        { // do ArUco detection
-          arUcos->doArUcoProcessing(im, imageNumber, imTime);
-          doArUcoAnalysis = false;
-          // robot pose is set after the processing, it is more likely that
-          // the pose is updated while processing.
-          // this is a bad idea, if robot is moving while grabbing images.
-          arUcos->setPoseAtImageTime(bridge->pose->x, bridge->pose->y, bridge->pose->h);
+        // keep a reduced copy for the flight recorder
+        recorder->addFrame(pyramid.get(2), imageNumber, imTime.getDecSec(), imPose);
+        // do submitted jobs
+        processJobs(im);
+        if (doArUcoContinuous and imageNumber % quality->knobs().arucoEvery == 0)
+          // markers for localisation (if not done by a job already)
+          trackArUco();
+        if (doLineAhead)
+          lineAhead->process(pyramid, imageNumber, imTime.getDecSec(), cameraMatrix,
+                             distortionCoefficients, cam2robot, cam2robotVersion);
+        if (doBallServo and imageNumber % quality->knobs().servoEvery == 0)
+        { // ball bearing and range at frame rate (or lower if overloaded)
+          float d, a;
+          bool found;
+          if (sceneUnchanged(ballCache))
+          { // nothing has changed - reuse
+            found = ballCache.result.found;
+            d = ballCache.result.distance;
+            a = ballCache.result.angle;
+            ballCache.hits++;
+          }
+          else
+          {
+            UVisionResult res;
+            found = detectBall(im, d, a);
+            res.found = found;
+            res.distance = d;
+            res.angle = a;
+            sceneStore(ballCache, res);
+            ballCache.misses++;
+            if (found)
+              mapBall(d, a);
+          }
+          lock_guard<mutex> guard(servoLock);
+          servoDistance = d;
+          servoAngle = a;
+          servoFound = found;
+          servoFrame = imageNumber;
+          for (int i = 0; i < 3; i++)
+            servoPose[i] = imPose[i];
         }
         if (doArUcoLoopTest and arucoLoop > 0)
         { // timing test - 100 ArUco analysis on 100 frames
@@ -275,26 +360,26 @@ void UCamera::run()
             dt = 0;
           arucoLoop--;
           t.now();
-          arUcos->doArUcoProcessing(im, imageNumber, imTime);
+          if (arucoTracking)
+            trackArUco();
+          else
+            arUcos->doArUcoProcessing(im, imageNumber, imTime);
           dt += t.getTimePassed();
           usleep(10000);
           if (arucoLoop == 0)
           { // finished
-            printf("# average ArUco analysis took %.2f ms\n", dt / 100 * 1000);
+            printf("# average ArUco analysis took %.2f ms (%s)\n", dt / 100 * 1000,
+                   arucoTracking ? "tracker" : "full image");
             doArUcoLoopTest = false;
             arucoLoop = 100;
           }
         }
+        // time from capture, lower quality if over budget
+        UTime tEnd;
+        tEnd.now();
+        quality->frameDone(tEnd - imTime, imageNumber);
       }
     }
-    else if (doArUcoAnalysis or saveImage or doObjectDetection)
-    { // no camera
-      printf("# ------  sorry, no camera is available ---------------\n");
-      saveImage = false;
-      doArUcoAnalysis = false;
-      doObjectDetection = false;
-      sleep(1);
-    }
     // wait a bit
     usleep(1000);
   }
@@ -313,7 +398,6 @@ void UCamera::saveImageAsPng(cv::Mat im, const char *filename)
   char date[25];
   char name[MNL];
   const char *usename = filename;
-  saveImage = false;
   // use date in filename
   // get date as string
   if (usename == NULL)
@@ -326,9 +410,7 @@ void UCamera::saveImageAsPng(cv::Mat im, const char *filename)
   // convert to RGB
   //cv::cvtColor(im, im, cv::COLOR_BGR2RGB);
   // make PNG option - compression level 6
-  vector<int> compression_params;
-  compression_params.push_back(cv::IMWRITE_PNG_COMPRESSION);
-  compression_params.push_back(6);
+  static const vector<int> compression_params = {cv::IMWRITE_PNG_COMPRESSION, 6};
   // save image
   cv::imwrite(name, im, compression_params);
   // debug message
@@ -342,12 +424,279 @@ void UCamera::saveImageAsPng(cv::Mat im, const char *filename)
 
 //////////////////////////////////////////////////
 
+UVisionJobPtr UCamera::submit(UVisionJobType type, const UVisionOptions &options)
+{
+  UVisionJobPtr job(new UVisionJob(type, options));
+  if (not cameraOpen)
+  {
+    printf("# ------  sorry, no camera is available ---------------\n");
+    job->finish(UVisionResult::NO_CAMERA);
+    return job;
+  }
+  lock_guard<mutex> guard(jobLock);
+  if ((int)jobs.size() >= MAX_JOBS)
+  {
+    printf("#UCamera::submit: too many vision jobs (max %d)\n", MAX_JOBS);
+    job->finish(UVisionResult::QUEUE_FULL);
+    jobDroppedCnt++;
+  }
+  else
+  {
+    jobs.push_back(job);
+    jobCnt++;
+  }
+  return job;
+}
+
+void UCamera::makeThumb()
+{
+  if (thumbFrame == imageNumber)
+    return;
+  UTime t;
+  t.now();
+  thumbFrame = imageNumber;
+  // from the level made for the flight recorder, so no extra pyramid level is built
+  cv::resize(pyramid.get(2), thumbColour, cv::Size(40, 30), 0, 0, cv::INTER_AREA);
+  cv::cvtColor(thumbColour, thumb, cv::COLOR_BGR2GRAY);
+  sceneTestTime += t.getTimePassed();
+}
+
+bool UCamera::sceneUnchanged(SceneCache &cache)
+{
+  if (not cache.valid)
+    return false;
+  makeThumb();
+  UTime t;
+  t.now();
+  sceneTestCnt++;
+  bool unchanged = false;
+  float dh = remainder(imPose[2] - cache.pose[2], 2 * M_PI);
+  if (hypot(imPose[0] - cache.pose[0], imPose[1] - cache.pose[1]) < sceneMaxMove and fabs(dh) < sceneMaxTurn)
+  { // robot is (about) still, so test image
+    lastSceneDiff = cv::norm(thumb, cache.thumb, cv::NORM_L1) / (thumb.rows * thumb.cols);
+    unchanged = lastSceneDiff < sceneMaxDiff;
+  }
+  sceneTestTime += t.getTimePassed();
+  return unchanged;
+}
+
+void UCamera::sceneStore(SceneCache &cache, const UVisionResult &result)
+{
+  makeThumb();
+  thumb.copyTo(cache.thumb);
+  for (int i = 0; i < 3; i++)
+    cache.pose[i] = imPose[i];
+  cache.result = result;
+  cache.result.cached = false;
+  cache.valid = true;
+}
+
+void UCamera::mapBall(float distance, float angle)
+{
+  float a = angle * M_PI / 180;
+  objects->add(UObjectMap::OBJ_BALL, 0, distance / 1000 * cos(a), distance / 1000 * sin(a),
+               imPose, imTime.getDecSec());
+}
+
+void UCamera::finishJobs(UVisionResult::Status status)
+{
+  lock_guard<mutex> guard(jobLock);
+  for (auto &job : jobs)
+    job->finish(status);
+  jobs.clear();
+}
+
 /**
- * Save image as png file and processes it for object detection
- * \param im is the 8-bit RGB image to save
- * \param filename is an optional image filename, if not used, then image is saved as image_[timestamp].png
- * */
-void UCamera::processBallDetection(cv::Mat im, const char *filename)
+ * Process jobs submitted before this image was taken.
+ * Save jobs are done first (the image may be annotated by detection),
+ * ArUco and ball detection is done once, even if more jobs are waiting
+ * \param im is the new image */
+void UCamera::processJobs(cv::Mat &im)
+{
+  vector<UVisionJobPtr> ready;
+  {
+    lock_guard<mutex> guard(jobLock);
+    for (auto it = jobs.begin(); it != jobs.end();)
+    {
+      // ArUco jobs may have to wait a frame or more, if overloaded
+      bool skip = (*it)->type == VJ_ARUCO and imageNumber % quality->knobs().arucoEvery != 0;
+      if (imTime - (*it)->submitTime >= 0 and not skip)
+      {
+        ready.push_back(*it);
+        it = jobs.erase(it);
+      }
+      else
+        it++;
+    }
+  }
+  if (ready.empty())
+    return;
+  UVisionResult ball;
+  bool ballDone = false, arucoDone = false;
+  UVisionResult found;
+  bool objectsDone = false;
+  const UVisionJobType order[] = {VJ_SAVE, VJ_ARUCO, VJ_OBJECTS, VJ_BALL};
+  for (UVisionJobType type : order)
+  {
+    for (auto &job : ready)
+    {
+      if (job->type != type)
+        continue;
+      if (job->cancelled)
+      {
+        job->finish(UVisionResult::CANCELLED);
+        continue;
+      }
+      if (job->options.deadline > 0 and imTime - job->submitTime > job->options.deadline)
+      {
+        job->finish(UVisionResult::EXPIRED);
+        continue;
+      }
+      UTime t;
+      t.now();
+      UVisionResult res;
+      res.frame = imageNumber;
+      res.imTime = imTime;
+      switch (type)
+      {
+      case VJ_SAVE:
+        // save image as PNG file (takes lots of time to compress and save to flash)
+        saveImageAsPng(im, job->options.name);
+        printf("Image saved\n");
+        break;
+      case VJ_ARUCO:
+        if (arucoTracking)
+        { // reduced image search and tracking
+          int frame;
+          trackArUco();
+          getArUcoMarkers(res.markers, frame);
+          res.found = not res.markers.empty();
+          break;
+        }
+        if (not arucoDone)
+        {
+          arUcos->doArUcoProcessing(im, imageNumber, imTime);
+          // robot pose is set after the processing, it is more likely that
+          // the pose is updated while processing.
+          // this is a bad idea, if robot is moving while grabbing images.
+          arUcos->setPoseAtImageTime(bridge->pose->x, bridge->pose->y, bridge->pose->h);
+          // markers found in this frame to object map (marker position is in robot coordinates)
+          for (int i = 0; i < MAX_CODE_COUNT; i++)
+          {
+            ArUcoVal &v = arUcos->arucos[i];
+            if (v.isValid and v.frameNumber == imageNumber)
+              objects->add(UObjectMap::OBJ_ARUCO, v.ID, v.markerPosition[0], v.markerPosition[1],
+                           imPose, imTime.getDecSec());
+          }
+          arucoDone = true;
+        }
+        res.found = true;
+        break;
+      case VJ_OBJECTS:
+        if (not objectsDone and sceneUnchanged(objectsCache))
+        { // same scene - reuse
+          found.objects = objectsCache.result.objects;
+          found.cached = true;
+          objectsCache.hits++;
+          objectsDone = true;
+        }
+        if (not objectsDone)
+        { // all object models in one pass
+          // start from the pyramid level nearest the wanted scale
+          float scale = quality->knobs().detectorScale;
+          int level = pyramid.levelFor(scale);
+          detector->scale = scale;
+          detector->detect(pyramid.get(level), UImagePyramid::scaleOf(level), cameraMatrix, cam2robot, found.objects);
+          for (auto &d : found.objects)
+            objects->add(UObjectMap::OBJ_MODEL, d.model, d.x, d.y, imPose, imTime.getDecSec());
+          sceneStore(objectsCache, found);
+          objectsCache.misses++;
+          objectsDone = true;
+        }
+        res.objects = found.objects;
+        res.cached = found.cached;
+        res.found = not found.objects.empty();
+        break;
+      case VJ_BALL:
+        if (not ballDone and not job->options.saveImage and sceneUnchanged(ballCache))
+        { // same scene - reuse
+          ball = ballCache.result;
+          ball.cached = true;
+          ballCache.hits++;
+          ballDone = true;
+        }
+        if (not ballDone)
+        {
+          cv::Mat mask;
+          if (job->options.saveImage)
+          { // full image search to get the full mask
+            saveImageAsPng(im, job->options.name);
+            ball.found = detectBall(im, ball.distance, ball.angle, &mask);
+          }
+          else
+            ball.found = detectBall(im, ball.distance, ball.angle);
+          printf("Balldetection distance is: %.3f\n", ball.distance);
+          printf("Balldetection angle is: %.3f\n", ball.angle);
+          if (ball.found)
+            mapBall(ball.distance, ball.angle);
+          sceneStore(ballCache, ball);
+          ballCache.misses++;
+          if (job->options.saveImage)
+            saveImageAsPng(mask, job->options.name);
+          ballDone = true;
+        }
+        res.found = ball.found;
+        res.distance = ball.distance;
+        res.angle = ball.angle;
+        res.cached = ball.cached;
+        break;
+      }
+      res.processTime = t.getTimePassed();
+      job->finish(res);
+    }
+  }
+}
+
+void UCamera::trackArUco()
+{
+  if (arucoFrame == imageNumber)
+    // done for this frame
+    return;
+  vector<UArUcoMarker> found;
+  arucoTracker->process(pyramid, imageNumber, cameraMatrix, distortionCoefficients, cam2robot, found);
+  for (auto &m : found)
+    objects->add(UObjectMap::OBJ_ARUCO, m.id, m.x, m.y, imPose, imTime.getDecSec());
+  lock_guard<mutex> guard(arucoLock);
+  arucoMarkers.swap(found);
+  arucoFrame = imageNumber;
+  for (int i = 0; i < 3; i++)
+    arucoPose[i] = imPose[i];
+}
+
+int UCamera::getArUcoMarkers(vector<UArUcoMarker> &markers, int &frame, float *pose)
+{
+  lock_guard<mutex> guard(arucoLock);
+  markers = arucoMarkers;
+  frame = arucoFrame;
+  if (pose != NULL)
+    for (int i = 0; i < 3; i++)
+      pose[i] = arucoPose[i];
+  return markers.size();
+}
+
+bool UCamera::getBallServo(float &distance, float &angle, int &frame, float *pose)
+{
+  lock_guard<mutex> guard(servoLock);
+  distance = servoDistance;
+  angle = servoAngle;
+  frame = servoFrame;
+  if (pose != NULL)
+    for (int i = 0; i < 3; i++)
+      pose[i] = servoPose[i];
+  return servoFound;
+}
+
+bool UCamera::detectBall(cv::Mat im, float &distance, float &angle, cv::Mat *mask)
 {
 
   float xd = 0;
@@ -357,43 +706,76 @@ void UCamera::processBallDetection(cv::Mat im, const char *filename)
   float alfa = 0;
   float vector[3] = {};
 
-  cv::Mat bgr_image = im;
-
-  cv::Mat orig_image = bgr_image.clone();
-  cv::medianBlur(bgr_image, bgr_image, 11); // 7,11,15 kernel works
+  // knobs may be reduced, if camera thread is overloaded
+  const UQualityLevel &q = quality->knobs();
+  // ball is on the floor, so top of image may be skipped (only column and radius is used)
+  int top = im.rows * q.roiTop;
+  cv::Rect roi(0, top, im.cols, im.rows - top);
+  UBallWorkspace &ws = ballWs;
+  if (mask == NULL and pyramid.get(0).data == im.data)
+  { // coarse search for red pixels (same thresholds), full resolution search near these only
+    const int level = 2;
+    const int f = 1 << level;
+    cv::Mat coarse = pyramid.get(level);
+    cv::cvtColor(coarse.rowRange(top / f, coarse.rows), ws.coarseHsv, cv::COLOR_BGR2HSV);
+    cv::inRange(ws.coarseHsv, cv::Scalar(0, 100, 77), cv::Scalar(220, 250, 255), ws.coarseLower);
+    cv::inRange(ws.coarseHsv, cv::Scalar(160, 100, 100), cv::Scalar(210, 255, 255), ws.coarseUpper);
+    cv::add(ws.coarseLower, ws.coarseUpper, ws.coarseMask);
+    cv::findNonZero(ws.coarseMask, ws.coarsePixels);
+    if ((int)ws.coarsePixels.size() < 3)
+    { // no ball
+      ws.coarseRejectCnt++;
+      ws.detectCnt++;
+      distance = 0;
+      angle = 0;
+      return false;
+    }
+    cv::Rect b = cv::boundingRect(ws.coarsePixels);
+    // to full resolution with a margin for the filter kernels
+    int margin = q.blurKernel + q.morphKernel + 2 * f;
+    roi &= cv::Rect(b.x * f - margin, (b.y + top / f) * f - margin,
+                    b.width * f + 2 * margin, b.height * f + 2 * margin);
+  }
+  cv::Mat bgr_image = im(roi);
+  // all intermediate images are in reused buffers (never in place)
+  ws.makeViews(im.rows, im.cols, roi);
+  cv::Mat &blurred = ws.view[UBallWorkspace::B_BLUR];
+  cv::Mat &hsv_image = ws.view[UBallWorkspace::B_HSV];
+  cv::Mat &lower_red_hue_range = ws.view[UBallWorkspace::B_LOWER];
+  cv::Mat &upper_red_hue_range = ws.view[UBallWorkspace::B_UPPER];
+  cv::Mat &finmask = ws.view[UBallWorkspace::B_MASK];
+  cv::Mat &opened = ws.view[UBallWorkspace::B_OPEN];
+  cv::Mat &red_hue_image = ws.view[UBallWorkspace::B_SMOOTH];
+
+  cv::medianBlur(bgr_image, blurred, q.blurKernel); // 7,11,15 kernel works
 
   // Convert input image to HSV
-  cv::Mat hsv_image;
-  cv::cvtColor(bgr_image, hsv_image, cv::COLOR_BGR2HSV);
+  cv::cvtColor(blurred, hsv_image, cv::COLOR_BGR2HSV);
 
   // Threshold the HSV image, keep only the red pixels
-  cv::Mat lower_red_hue_range;
-  cv::Mat upper_red_hue_range;
-  cv::Mat finmask;
   cv::inRange(hsv_image, cv::Scalar(0, 100, 77), cv::Scalar(220, 250, 255), lower_red_hue_range); // 0,100,100 10,255,255
   cv::inRange(hsv_image, cv::Scalar(160, 100, 100), cv::Scalar(210, 255, 255), upper_red_hue_range);
 
-  finmask = lower_red_hue_range + upper_red_hue_range;
-
-  cv::Mat red_hue_image;
-  cv::addWeighted(lower_red_hue_range, 1.0, upper_red_hue_range, 1.0, 0.0, red_hue_image);
+  // combined (saturated) mask
+  cv::add(lower_red_hue_range, upper_red_hue_range, finmask);
 
   // Morphology
-  cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(15, 15));
-  cv::morphologyEx(red_hue_image, red_hue_image, cv::MORPH_OPEN, element);
+  cv::morphologyEx(finmask, opened, cv::MORPH_OPEN, ws.getElement(q.morphKernel));
 
   // Filter size 11,11 is working
-  cv::GaussianBlur(red_hue_image, red_hue_image, cv::Size(11, 11), 2, 2);
+  cv::GaussianBlur(opened, red_hue_image, cv::Size(q.blurKernel, q.blurKernel), 2, 2);
 
   // Use the Hough transform to detect circles in the combined threshold image
-  std::vector<cv::Vec3f> circles;
-  cv::HoughCircles(red_hue_image, circles, CV_HOUGH_GRADIENT, 1, red_hue_image.rows / 8, 100, 20, 0, 0); // 8,100,20,0,0 // 4 and 16 not working and if we change last two parameters then its not working
+  std::vector<cv::Vec3f> &circles = ws.circles;
+  cv::HoughCircles(red_hue_image, circles, CV_HOUGH_GRADIENT, 1, (im.rows - top) / 8, 100, 20, 0, 0); // 8,100,20,0,0 // 4 and 16 not working and if we change last two parameters then its not working
+  ws.countAllocations();
 
   // Loop over all detected circles and outline them on the original image
   for (auto vec : circles)
   {
-    vector[0] = vec[0];
-    vector[1] = vec[1];
+    // circle position in full image
+    vector[0] = vec[0] + roi.x;
+    vector[1] = vec[1] + roi.y;
     vector[2] = vec[2];
   }
 
@@ -440,18 +822,14 @@ void UCamera::processBallDetection(cv::Mat im, const char *filename)
 	cv::circle(orig_image, center, radius, cv::Scalar(0, 255, 0), 5);
   }
   */
-  distanceToObject = true_dist;
-  angleToObject = true_alfa;
-
-  doObjectDetection = false;
-
-  printf("Balldetection distance is: %.3f\n", distanceToObject);
-  printf("Balldetection angle is: %.3f\n", angleToObject);
-
-  saveImageAsPng(finmask);
-  saveImageAsPng(im);
+  distance = true_dist;
+  angle = true_alfa;
+  if (mask != NULL)
+    *mask = finmask;
+  return circles.size() > 0 and true_dist > 0;
 }
 
+
 //////////////////////////////////////////////////////////////////
 
 void UCamera::makeCamToRobotTransformation()
@@ -497,6 +875,7 @@ void UCamera::makeCamToRobotTransformation()
                 0, 0, 0, 1);
   // combine to one matrix
   cam2robot = tranH * rotzH * rotyH * rotxH * cc;
+  cam2robotVersion++;
 }
 
 void UCamera::setRoll(float roll)
@@ -24,7 +24,7 @@
 #include <iostream>
 #include <sys/time.h>
 #include <thread>
-// #include <mutex>
+#include <mutex>
 #include <opencv2/core/core.hpp>
 #include <opencv2/videoio.hpp>
 //#include <string>
@@ -34,6 +34,15 @@
 #include "utime.h"
 // #include "u2dline.h"
 #include "uaruco.h"
+#include "uvisionjob.h"
+#include "uobjectmap.h"
+#include "uobjectdetect.h"
+#include "uflightrecorder.h"
+#include "uvisionquality.h"
+#include "uballworkspace.h"
+#include "uimagepyramid.h"
+#include "uarucotrack.h"
+#include "ulineahead.h"
 // this should be defined in the CMakeList.txt ? or ?
 #ifdef raspicam_CV_LIBS
 #include <raspicam/raspicam.h>
@@ -50,26 +59,53 @@ using namespace std;
 class UCamera : public URun
 { // raw camera functions
 public:
-  // flag to save an image to disk
-  bool saveImage = false;
-  // flag to perform object detection
-  bool doObjectDetection = false;
-  // distance result of object detection
-  float distanceToObject = 0.0;
-  // angle result of object detection
-  float angleToObject = 0.0;
-  // flad to do ArUcoAnalysis
-  bool doArUcoAnalysis = false;
+  /// max number of outstanding vision jobs
+  const static int MAX_JOBS = 8;
+  /// detection results are reused if the scene changed less than this
+  /// (mean absolute difference in grey levels of a 40x30 thumbnail)
+  float sceneMaxDiff = 4.0;
+  /// and the robot moved less than this [m] and turned less than this [rad]
+  float sceneMaxMove = 0.01;
+  float sceneMaxTurn = 0.01;
+  // flag to do ball detection on every frame (for visual servoing)
+  bool doBallServo = false;
   /// do loop-test (aruco log)
   bool doArUcoLoopTest = false;
+  /// use the ArUco tracker (reduced image search and tracking) for ArUco jobs and loop-test
+  bool arucoTracking = false;
+  /// run the ArUco tracker on every frame (or every arucoEvery frame if overloaded)
+  bool doArUcoContinuous = false;
+  /// find the line ahead on every frame (result in lineAhead)
+  bool doLineAhead = false;
   // opened OK
   bool cameraOpen = false;
+  // camera settings (exposure) are in steady state, vision jobs wait until then
+  bool cameraReady = false;
+  // frames and time used to reach steady state [sec]
+  int warmUpFrames = 0;
+  float warmUpTime = 0;
   // detected ArUco markers
   ArUcoVals *arUcos = NULL;
+  // ArUco detection on a reduced image with marker tracking
+  UArUcoTracker *arucoTracker = NULL;
+  // line ahead of the robot (for speed planning in line following)
+  ULineAhead *lineAhead = NULL;
+  // detected objects in world coordinates (balls and ArUco markers)
+  UObjectMap *objects = NULL;
+  // detector for all registered object models (colour, size and shape)
+  UObjectDetector *detector = NULL;
+  // black-box recorder of last frames (and mission state)
+  UFlightRecorder *recorder = NULL;
+  // frame deadline tracking and adaptive vision quality
+  UVisionQuality *quality = NULL;
+  // reduced images of the current frame, made on request, shared by detectors
+  UImagePyramid pyramid;
   // camera position on robot
   cv::Vec3d camPos = {0.03, 0.03, 0.27};        /// x=fwd, y=left, z=up
   cv::Vec3d camRot = {0, 10 * M_PI / 180.0, 0}; /// roll, tilt, yaw (right hand rule, radians)
   cv::Mat cam2robot;
+  /// changed every time cam2robot is made, so that maps made from it can be remade
+  int cam2robotVersion = 0;
   //
   /** camera matrix is a 3x3 matrix (raspberry PI typical values)
    *    pix    ---1----  ---2---  ---3---   -3D-
@@ -123,6 +159,14 @@ public:
   void setPan(float pan);
   void setRoll(float roll);
   void setPos(float x, float y, float z);
+  /**
+   * Submit a vision job (ball detection, ArUco detection or save image)
+   * to be processed on the next frame.
+   * \param type is the job type
+   * \param options has deadline and image save options
+   * \returns the job, the result is available through job->result (a future),
+   * if the queue is full (or no camera), then the result is available at once */
+  UVisionJobPtr submit(UVisionJobType type, const UVisionOptions &options = UVisionOptions());
 
 private:
   // pointer to regbot interface
@@ -131,8 +175,67 @@ private:
   int imageNumber = 0;
   // time image was taken
   UTime imTime, im2Time;
+  // robot pose (x, y, h) when image was taken
+  float imPose[3] = {0};
   // logfile for images
   FILE *logImg = NULL;
+  // latest ball servo observation
+  mutex servoLock;
+  float servoDistance = 0, servoAngle = 0;
+  int servoFrame = 0;
+  float servoPose[3] = {0};
+  bool servoFound = false;
+  // latest ArUco tracker result
+  mutex arucoLock;
+  vector<UArUcoMarker> arucoMarkers;
+  int arucoFrame = -1;
+  float arucoPose[3] = {0};
+  // reused buffers for ball detection
+  UBallWorkspace ballWs;
+  // scene change detection, cached results are reused if scene is unchanged
+  struct SceneCache
+  {
+    bool valid = false;
+    cv::Mat thumb;
+    float pose[3];
+    UVisionResult result;
+    int hits = 0, misses = 0;
+  };
+  SceneCache ballCache, objectsCache;
+  // thumbnail of current frame (grey), made for image number thumbFrame
+  cv::Mat thumb, thumbColour;
+  int thumbFrame = -1;
+  // change metric statistics
+  int sceneTestCnt = 0;
+  double sceneTestTime = 0;
+  float lastSceneDiff = 0;
+  /**
+   * Make thumbnail of current frame, if not made already.
+   * Made only when a scene test or store needs it */
+  void makeThumb();
+  /**
+   * Test if scene (and pose) is unchanged since result was cached */
+  bool sceneUnchanged(SceneCache &cache);
+  /**
+   * Save result in cache with current thumbnail and pose */
+  void sceneStore(SceneCache &cache, const UVisionResult &result);
+  // submitted vision jobs
+  mutex jobLock;
+  vector<UVisionJobPtr> jobs;
+  int jobCnt = 0, jobDroppedCnt = 0;
+  /**
+   * Process (or drop) the jobs submitted before this image was taken */
+  void processJobs(cv::Mat &im);
+  /**
+   * Run the ArUco tracker on this frame (if not done already),
+   * markers are added to the object map */
+  void trackArUco();
+  /**
+   * Add ball detection (from this frame) to object map */
+  void mapBall(float distance, float angle);
+  /**
+   * Finish all waiting jobs with this status */
+  void finishJobs(UVisionResult::Status status);
   //   /// logfile for ArUco extract
   //   FILE * logArUco = NULL;
 
@@ -140,8 +243,30 @@ public:
   /**
    * Save image to flashdisk */
   void saveImageAsPng(cv::Mat im, const char *filename = NULL);
-  /* Perform object detection */
-  void processBallDetection(cv::Mat im, const char *filename = NULL);
+  /**
+   * Find red ball in image
+   * \param im is the 8-bit BGR image (not changed)
+   * \param distance is set to distance from robot center to ball in mm
+   * \param angle is set to angle to ball in degrees (positive is left)
+   * \param mask if not NULL, then the colour mask is returned here (valid until next detection),
+   * else, if im is the current frame, red pixels are found in a coarse image first,
+   * and only the region around these is searched at full resolution
+   * \returns true if a ball is found */
+  bool detectBall(cv::Mat im, float &distance, float &angle, cv::Mat *mask = NULL);
+  /**
+   * Get latest ball observation in servo mode (doBallServo = true)
+   * \param distance, angle is result (as detectBall())
+   * \param frame is the image number of the observation
+   * \param pose if not NULL, then robot pose (x, y, h) at image time is returned here
+   * \returns true if the ball was found in that frame */
+  bool getBallServo(float &distance, float &angle, int &frame, float *pose = NULL);
+  /**
+   * Get markers found by the ArUco tracker in the latest processed frame
+   * \param markers is set to the markers found
+   * \param frame is the image number
+   * \param pose if not NULL, then robot pose (x, y, h) at image time is returned here
+   * \returns number of markers */
+  int getArUcoMarkers(vector<UArUcoMarker> &markers, int &frame, float *pose = NULL);
 
 protected:
   /**
@@ -173,6 +298,11 @@ protected:
    * \param image is the destination for the image
    * \returns timestamp when the image was grabbed. */
   timeval capture(cv::Mat &image);
+  /**
+   * Grab frames until the image intensity is stable (exposure has settled),
+   * at most 30 frames. Done by the camera thread, so that startup
+   * does not wait for the camera. */
+  void warmUp(cv::Mat &image);
   /**
    * Configure camera */
   bool setupCamera()
@@ -196,9 +326,7 @@ protected:
     }
     else
       isOpen = true;
-    for (int i = 0; i < 30; i++)
-      // just to make sure camera settings has reached steady state
-      camDev.grab();
+    // camera settings reach steady state in the camera thread (warmUp())
     cout << "Connected to pi-camera ='" << camDev.getId() << "\r\n";
 #endif
     return isOpen;
@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+#include "ucmdchannel.h"
+
+UCmdChannel::UCmdChannel(UBridge *reg)
+{
+  bridge = reg;
+  th1 = NULL;
+  th1stop = false;
+  for (int i = 0; i < MAX_STATUS_LINES; i++)
+  {
+    status[i][0] = '\0';
+    statusDirty[i] = false;
+  }
+  th1 = new thread(runObj, this);
+}
+
+UCmdChannel::~UCmdChannel()
+{
+  stop();
+}
+
+double UCmdChannel::now()
+{
+  USim *simulator = sim;
+  if (simulator != NULL)
+    return simulator->time();
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void UCmdChannel::send(const char *cmd)
+{
+  lock_guard<mutex> guard(sendLock);
+  USim *simulator = sim;
+  if (simulator != NULL)
+    simulator->send(cmd);
+  else
+    bridge->send(cmd);
+  if (traffic != NULL)
+    traffic->command(cmd, false);
+  lastMissionCmd = now();
+  missionCmdCnt++;
+}
+
+void UCmdChannel::setStatus(int line, const char *text)
+{
+  if (line < 0 or line >= MAX_STATUS_LINES)
+    return;
+  lock_guard<mutex> guard(statusLock);
+  if (strncmp(status[line], text, MAX_LEN) != 0 or statusDirty[line])
+  { // new text, replaces any unsend text
+    strncpy(status[line], text, MAX_LEN - 1);
+    status[line][MAX_LEN - 1] = '\0';
+    statusDirty[line] = true;
+  }
+  statusSetCnt++;
+}
+
+bool UCmdChannel::sendStatus()
+{
+  const int MSL = MAX_LEN + 20;
+  char s[MSL];
+  int line = -1;
+  {
+    lock_guard<mutex> guard(statusLock);
+    for (int i = 0; i < MAX_STATUS_LINES; i++)
+    { // round robin, so that all lines get updated
+      int n = (nextLine + i) % MAX_STATUS_LINES;
+      if (statusDirty[n])
+      {
+        line = n;
+        break;
+      }
+    }
+    if (line < 0)
+      return false;
+    snprintf(s, MSL, "oled %d %s\n", line, status[line]);
+    statusDirty[line] = false;
+    nextLine = (line + 1) % MAX_STATUS_LINES;
+  }
+  lock_guard<mutex> guard(sendLock);
+  USim *simulator = sim;
+  if (simulator != NULL)
+    simulator->send(s);
+  else
+    bridge->send(s);
+  if (traffic != NULL)
+    traffic->command(s, true);
+  statusSendCnt++;
+  return true;
+}
+
+void UCmdChannel::pollStatus()
+{
+  double t = now();
+  if (uploading == 0 and t - lastMissionCmd > quietTime and t - lastStatus > 1.0 / statusRate)
+  {
+    if (sendStatus())
+      lastStatus = t;
+  }
+}
+
+void UCmdChannel::run()
+{
+  while (not th1stop)
+  {
+    if (sim == NULL)
+      pollStatus();
+    usleep(5000);
+  }
+}
+
+void UCmdChannel::stop()
+{
+  th1stop = true;
+  if (th1 != NULL)
+  {
+    th1->join();
+    delete th1;
+    th1 = NULL;
+    // last status (e.g. 'finished') should be shown
+    while (sendStatus())
+      ;
+  }
+}
+
+void UCmdChannel::printStatus()
+{
+  printf("# command channel: %d mission commands, status set %d times, send %d times (max %g/s)\n",
+         missionCmdCnt, statusSetCnt, statusSendCnt, statusRate);
+}
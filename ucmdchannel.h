@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UCMDCHANNEL_H
+#define UCMDCHANNEL_H
+
+#include <mutex>
+#include <atomic>
+#include "urun.h"
+#include "ubridge.h"
+#include "usim.h"
+#include "utraffic.h"
+
+/**
+ * Send path from the mission to the bridge (or simulator).
+ * Mission commands are send at once (high priority).
+ * Status for the O-led display is low priority: only the latest
+ * text for each display line is kept, and it is send by the channel thread
+ * at a limited rate, and only when there is no mission traffic. */
+class UCmdChannel : public URun
+{
+public:
+  /// number of O-led display lines
+  const static int MAX_STATUS_LINES = 8;
+  const static int MAX_LEN = 100;
+  /// max status lines send per second
+  float statusRate = 5;
+  /// no status is send this long after a mission command [sec] (simulated time, when simulated)
+  float quietTime = 0.03;
+
+public:
+  /** Constructor - starts the status thread */
+  UCmdChannel(UBridge *reg);
+  /** destructor */
+  ~UCmdChannel();
+  /** send to simulator instead of bridge, if not NULL */
+  void setSim(USim *simulator)
+  {
+    sim = simulator;
+  }
+  /** record all send commands to this trace, if not NULL */
+  void setTraffic(UTraffic *trace)
+  {
+    traffic = trace;
+  }
+  /**
+   * Send a mission command at once (high priority) */
+  void send(const char *cmd);
+  /**
+   * Mission is sending a number of commands (e.g. a snippet),
+   * hold back status until uploadEnd() */
+  void uploadBegin()
+  {
+    uploading++;
+  }
+  void uploadEnd()
+  {
+    uploading--;
+  }
+  /**
+   * Set status text for a display line (low priority),
+   * replaces any not yet send text for this line.
+   * \param line is the O-led line number
+   * \param text is the text to show */
+  void setStatus(int line, const char *text);
+  /** send all pending status now and stop thread */
+  void stop();
+  /** print status */
+  void printStatus();
+  /**
+   * Send a pending status line, if the rate limit and mission traffic allow it.
+   * Called by the status thread, and when simulated by the mission after each
+   * simulated time step (the status thread is then idle), so that the status
+   * follows the simulated time at any time scale. */
+  void pollStatus();
+  /** status thread */
+  void run();
+
+private:
+  /** send a pending status line, returns false if none */
+  bool sendStatus();
+  /** time now in seconds - simulated time when simulated, as the mission */
+  double now();
+  //
+  UBridge *bridge;
+  /// set by the mission thread, tested by the status thread
+  atomic<USim *> sim{NULL};
+  UTraffic *traffic = NULL;
+  /// lock for the send path, and for status text
+  mutex sendLock;
+  mutex statusLock;
+  atomic<int> uploading{0};
+  /// set by the mission thread, tested by the status thread
+  atomic<double> lastMissionCmd{0};
+  double lastStatus = 0;
+  char status[MAX_STATUS_LINES][MAX_LEN];
+  bool statusDirty[MAX_STATUS_LINES];
+  int nextLine = 0;
+  /// statistics
+  int missionCmdCnt = 0;
+  int statusSetCnt = 0;
+  int statusSendCnt = 0;
+};
+
+#endif
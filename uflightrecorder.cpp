@@ -0,0 +1,204 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/opencv.hpp>
+#include "uflightrecorder.h"
+#include "utime.h"
+
+UFlightRecorder::UFlightRecorder(int budgetMB, int frameWidth, int frameHeight)
+{
+  width = frameWidth;
+  height = frameHeight;
+  // YUV 4:2:0 is 1.5 bytes per pixel
+  int slotSize = width * height * 3 / 2;
+  int slots = budgetMB * 1024 * 1024 / slotSize;
+  frames.resize(slots);
+  for (auto &f : frames)
+    f.yuv.create(height * 3 / 2, width, CV_8UC1);
+  // mission loop is 10ms, so 200 records per second is plenty
+  states.resize(int(seconds * 200));
+  th1stop = false;
+  th1 = new thread(runObj, this);
+}
+
+UFlightRecorder::~UFlightRecorder()
+{
+  stop();
+}
+
+void UFlightRecorder::stop()
+{
+  {
+    lock_guard<mutex> guard(lock);
+    th1stop = true;
+  }
+  dumpCv.notify_all();
+  if (th1 != NULL)
+  {
+    th1->join();
+    delete th1;
+    th1 = NULL;
+  }
+}
+
+void UFlightRecorder::addFrame(const cv::Mat &im, int frame, double t, const float *pose)
+{
+  lock_guard<mutex> guard(lock);
+  if (dumping or frames.empty())
+    return;
+  FrameSlot &f = frames[frameHead];
+  // slot buffer has the right size, so no allocation here
+  if (im.cols == width and im.rows == height)
+    // already reduced (pyramid level)
+    cv::cvtColor(im, f.yuv, cv::COLOR_BGR2YUV_I420);
+  else
+  {
+    cv::resize(im, small, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+    cv::cvtColor(small, f.yuv, cv::COLOR_BGR2YUV_I420);
+  }
+  f.frame = frame;
+  f.t = t;
+  for (int i = 0; i < 3; i++)
+    f.pose[i] = pose[i];
+  frameHead = (frameHead + 1) % frames.size();
+  if (frameCnt < (int)frames.size())
+    frameCnt++;
+}
+
+void UFlightRecorder::addState(double t, int mission, int state, const float *pose)
+{
+  lock_guard<mutex> guard(lock);
+  if (dumping)
+    return;
+  StateRec &r = states[stateHead];
+  r.t = t;
+  r.mission = mission;
+  r.state = state;
+  for (int i = 0; i < 3; i++)
+    r.pose[i] = pose[i];
+  stateHead = (stateHead + 1) % states.size();
+  if (stateCnt < (int)states.size())
+    stateCnt++;
+}
+
+void UFlightRecorder::trigger(const char *why)
+{
+  {
+    lock_guard<mutex> guard(lock);
+    triggerCnt++;
+    if (dumping)
+      return;
+    dumping = true;
+    reason = why;
+  }
+  printf("# UFlightRecorder:: dump of last %.0f seconds (%s)\n", seconds, why);
+  dumpCv.notify_all();
+}
+
+void UFlightRecorder::dump()
+{
+  const int MNL = 100;
+  char date[MNL];
+  char name[MNL];
+  UTime t;
+  t.now();
+  t.getForFilename(date);
+  // newest record is the time reference
+  double tEnd = 0;
+  if (stateCnt > 0)
+    tEnd = states[(stateHead + states.size() - 1) % states.size()].t;
+  snprintf(name, MNL, "flight_%s_state.txt", date);
+  FILE *f = fopen(name, "w");
+  if (f != NULL)
+  {
+    fprintf(f, "%% flight recorder dump (%s)\n", reason.c_str());
+    fprintf(f, "%% 1 time [sec]\n");
+    fprintf(f, "%% 2 mission\n");
+    fprintf(f, "%% 3 mission state\n");
+    fprintf(f, "%% 4,5,6 pose (x,y,h) [m,m,rad]\n");
+    for (int i = 0; i < stateCnt; i++)
+    {
+      StateRec &r = states[(stateHead - stateCnt + i + states.size()) % states.size()];
+      if (tEnd - r.t <= seconds)
+        fprintf(f, "%.3f %d %d %.3f %.3f %.4f\n", r.t, r.mission, r.state, r.pose[0], r.pose[1], r.pose[2]);
+    }
+    fclose(f);
+  }
+  else
+    printf("# UFlightRecorder:: failed to open %s\n", name);
+  if (frameCnt == 0)
+    return;
+  // frames
+  snprintf(name, MNL, "flight_%s_frames.txt", date);
+  f = fopen(name, "w");
+  if (f != NULL)
+  {
+    fprintf(f, "%% flight recorder frames (%s)\n", reason.c_str());
+    fprintf(f, "%% 1 image time [sec]\n");
+    fprintf(f, "%% 2 frame number (image is flight_%s_NNNNN.png)\n", date);
+    fprintf(f, "%% 3,4,5 pose at image time (x,y,h) [m,m,rad]\n");
+  }
+  double tNewest = frames[(frameHead + frames.size() - 1) % frames.size()].t;
+  cv::Mat bgr;
+  for (int i = 0; i < frameCnt; i++)
+  {
+    FrameSlot &fs = frames[(frameHead - frameCnt + i + frames.size()) % frames.size()];
+    if (tNewest - fs.t > seconds)
+      continue;
+    cv::cvtColor(fs.yuv, bgr, cv::COLOR_YUV2BGR_I420);
+    snprintf(name, MNL, "flight_%s_%05d.png", date, fs.frame);
+    cv::imwrite(name, bgr);
+    if (f != NULL)
+      fprintf(f, "%.3f %d %.3f %.3f %.4f\n", fs.t, fs.frame, fs.pose[0], fs.pose[1], fs.pose[2]);
+  }
+  if (f != NULL)
+    fclose(f);
+}
+
+void UFlightRecorder::run()
+{
+  unique_lock<mutex> guard(lock);
+  while (not th1stop or dumping)
+  {
+    if (dumping)
+    { // rings are not changed while dumping
+      guard.unlock();
+      UTime t;
+      t.now();
+      dump();
+      lastDumpTime = t.getTimePassed();
+      guard.lock();
+      dumpCnt++;
+      dumping = false;
+      printf("# UFlightRecorder:: dump finished in %.1f s\n", lastDumpTime);
+    }
+    else
+      dumpCv.wait(guard);
+  }
+}
+
+void UFlightRecorder::printStatus()
+{
+  printf("# flight recorder: %d frame slots (%dx%d YUV) holding %d frames, %d state records\n",
+         (int)frames.size(), width, height, frameCnt, stateCnt);
+  printf("#   %d triggers, %d dumps (last took %.1f s), dumping=%d\n", triggerCnt, dumpCnt, lastDumpTime, dumping);
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UFLIGHTRECORDER_H
+#define UFLIGHTRECORDER_H
+
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <string>
+#include <opencv2/core/core.hpp>
+#include "urun.h"
+
+using namespace std;
+
+/**
+ * Black-box recorder for the last seconds of camera frames and mission state.
+ * Frames are reduced and stored as YUV 4:2:0 in a ring of slots allocated
+ * at construction (fixed memory budget), mission state and pose in a ring of
+ * small records. On a trigger (stop, safety stop, detection miss, button)
+ * the rings are written to disk by the recorder thread, recording is paused
+ * while the dump is in progress.
+ * Files are flight_[date]_state.txt, flight_[date]_frames.txt and flight_[date]_NNNNN.png */
+class UFlightRecorder : public URun
+{
+public:
+  /// seconds of history to dump
+  float seconds = 10;
+
+public:
+  /**
+   * Constructor - allocates the rings and starts the dump thread
+   * \param budgetMB is memory for frames (in MB)
+   * \param width, height is stored frame size */
+  UFlightRecorder(int budgetMB = 24, int width = 320, int height = 240);
+  /** destructor */
+  ~UFlightRecorder();
+  /**
+   * Add a camera frame (BGR)
+   * \param frame is image number, t is image time [sec]
+   * \param pose is robot pose (x, y, h) at image time */
+  void addFrame(const cv::Mat &im, int frame, double t, const float *pose);
+  /**
+   * Add mission state and pose
+   * \param t is time [sec] (same clock as frames) */
+  void addState(double t, int mission, int state, const float *pose);
+  /**
+   * Dump the recorded history to disk (in the background).
+   * Ignored if a dump is in progress.
+   * \param reason is saved in the log */
+  void trigger(const char *reason);
+  /** print status */
+  void printStatus();
+  /** stop dump thread (a requested dump is finished first) */
+  void stop();
+  /** dump thread */
+  void run();
+
+private:
+  struct FrameSlot
+  {
+    cv::Mat yuv;
+    int frame;
+    double t;
+    float pose[3];
+  };
+  struct StateRec
+  {
+    double t;
+    int mission, state;
+    float pose[3];
+  };
+  /** write rings to disk */
+  void dump();
+  //
+  int width, height;
+  vector<FrameSlot> frames;
+  int frameHead = 0, frameCnt = 0;
+  vector<StateRec> states;
+  int stateHead = 0, stateCnt = 0;
+  /// reduced frame (reused)
+  cv::Mat small;
+  mutex lock;
+  condition_variable dumpCv;
+  bool dumping = false;
+  string reason;
+  /// statistics
+  int triggerCnt = 0, dumpCnt = 0;
+  float lastDumpTime = 0;
+};
+
+#endif
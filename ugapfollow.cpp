@@ -0,0 +1,112 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <cmath>
+#include "ugapfollow.h"
+
+void UGapFollow::measure(float dist, double t, float a, float b)
+{
+  if (not valid)
+  { // new lead robot
+    gap = dist;
+    gapRate = 0;
+    valid = true;
+    lastTime = t;
+  }
+  else
+  {
+    float dt = t - lastTime;
+    if (dt > 0)
+    { // predict
+      gap += gapRate * dt;
+      lastTime = t;
+    }
+    float r = dist - gap;
+    gap += a * r;
+    if (dt > 0.001)
+      gapRate += b * r / dt;
+  }
+  lastMeasure = t;
+  minSeen = fminf(minSeen, gap);
+}
+
+void UGapFollow::measureIr(float dist, float vOwn, double t)
+{
+  if (t == lastIrTime)
+    // not a new value
+    return;
+  lastIrTime = t;
+  if (dist > irMax)
+  { // nothing in front
+    if (valid and t - lastMeasure >= lostTime)
+    {
+      valid = false;
+      lostCnt++;
+    }
+    return;
+  }
+  bool isNew = not valid;
+  double dt = t - lastMeasure;
+  measure(dist, t, alpha, beta);
+  if (isNew)
+    // assume same velocity
+    leadVel = vOwn;
+  else if (dt > 0)
+    leadVel += (vOwn + gapRate - leadVel) * fminf(1.0, dt / leadTau);
+  irCnt++;
+}
+
+float UGapFollow::velocity(double t)
+{
+  float v = cruise;
+  if (hasLead(t))
+  { // lead velocity corrected by gap error
+    float vLead = fmaxf(0, leadVel);
+    float err = gap - minGap - timeGap * vLead;
+    // no correction of small errors, so the velocity settles at the lead velocity
+    err = copysignf(fmaxf(0, fabsf(err) - gapDeadband), err);
+    v = vLead + kGap * err;
+    v = fmaxf(0, fminf(cruise, v));
+    if (stopped)
+      // wait until the lead robot is clearly away
+      stopped = v < startVel;
+    else if (v < stopVel and vLead < stopVel)
+    { // lead robot stands still, stop rather than creep into it
+      stopped = true;
+      stopCnt++;
+    }
+    if (stopped)
+      v = 0;
+  }
+  else
+    stopped = false;
+  lastVel = v;
+  return v;
+}
+
+void UGapFollow::printStatus()
+{
+  printf("# gap follow: time gap %.1fs, min gap %.2fm, cruise %.2fm/s\n", timeGap, minGap, cruise);
+  printf("#   lead %s, gap %.2fm, rate %.2fm/s, lead %.2fm/s, velocity %.2fm/s (min gap seen %.2fm)\n",
+         valid ? "seen" : "not seen", gap, gapRate, leadVel, lastVel, minSeen);
+  printf("#   %d IR measurements, lost %d times, stopped %d times\n", irCnt, lostCnt, stopCnt);
+}
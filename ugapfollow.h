@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef UGAPFOLLOW_H
+#define UGAPFOLLOW_H
+
+/**
+ * Adaptive cruise behind a lead robot.
+ * The gap to the lead robot is measured by the front IR sensor,
+ * and filtered at sensor rate by a constant velocity
+ * (alpha-beta) filter, that gives gap and closing speed.
+ * The lead robot velocity (own velocity plus closing speed) is low-pass
+ * filtered, and the velocity is set to keep a time gap: the wanted gap is
+ * minGap + timeGap * lead velocity, the velocity is the lead velocity
+ * corrected by the gap error (outside a small deadband), limited to 0..cruise.
+ * The follower stops only when the lead robot stands still (and stays stopped
+ * until the wanted velocity is clearly above the stop velocity),
+ * so a slow lead robot is followed at low speed, not by stop and go. */
+class UGapFollow
+{
+public:
+  /// gap at standstill [m] (larger than the safety stop distance)
+  float minGap = 0.3;
+  /// time gap [sec]
+  float timeGap = 1.0;
+  /// gap error gain [1/sec]
+  float kGap = 0.8;
+  /// gap errors smaller than this are not corrected [m] (the velocity is then the lead velocity)
+  float gapDeadband = 0.03;
+  /// IR values above this are no lead robot [m]
+  float irMax = 1.0;
+  /// filter gains (gap and gap rate)
+  float alpha = 0.3, beta = 0.05;
+  /// lead is lost, if not measured for this long [sec]
+  float lostTime = 0.5;
+  /// velocities below this are a stop, when the lead robot is not moving [m/s]
+  float stopVel = 0.05;
+  /// after a stop, start again when the velocity is above this [m/s]
+  float startVel = 0.1;
+  /// time constant of the lead velocity filter [sec]
+  float leadTau = 0.5;
+  /// speed when there is no lead robot in range (e.g. line speed) [m/s]
+  float cruise = 0.4;
+
+public:
+  /**
+   * IR measurement of gap
+   * \param dist is IR distance [m]
+   * \param vOwn is own velocity [m/s] (to estimate the lead velocity)
+   * \param t is measurement time [sec] (a repeated time is ignored),
+   * same clock as the time given to velocity() */
+  void measureIr(float dist, float vOwn, double t);
+  /**
+   * Velocity to keep the time gap
+   * \param t is time now [sec]
+   * \returns velocity [m/s] */
+  float velocity(double t);
+  /** lead robot is in range */
+  bool hasLead(double t)
+  {
+    return valid and t - lastMeasure < lostTime;
+  }
+  /** forget lead robot */
+  void reset()
+  {
+    valid = false;
+    stopped = false;
+    lastIrTime = -1;
+  }
+  /** print status */
+  void printStatus();
+
+  /// filtered gap [m] and gap rate [m/s] (negative is closing)
+  float gap = 0, gapRate = 0;
+  /// filtered lead robot velocity [m/s]
+  float leadVel = 0;
+
+private:
+  /** filter update with a measurement */
+  void measure(float dist, double t, float a, float b);
+  bool valid = false;
+  double lastTime = 0, lastMeasure = 0;
+  double lastIrTime = -1;
+  float lastVel = 0;
+  bool stopped = false;
+  /// statistics
+  int irCnt = 0, lostCnt = 0, stopCnt = 0;
+  float minSeen = 100;
+};
+
+#endif
@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "uimagepyramid.h"
+#include "utime.h"
+
+void UImagePyramid::setFrame(const cv::Mat &im, int frameNumber)
+{
+  lock_guard<mutex> guard(lock);
+  level[0] = im;
+  valid[0] = true;
+  for (int i = 1; i < LEVEL_CNT; i++)
+    valid[i] = false;
+  frame = frameNumber;
+}
+
+cv::Mat UImagePyramid::get(int n)
+{
+  if (n < 0)
+    n = 0;
+  else if (n >= LEVEL_CNT)
+    n = LEVEL_CNT - 1;
+  lock_guard<mutex> guard(lock);
+  requestCnt[n]++;
+  if (not valid[0])
+    // no frame yet
+    return cv::Mat();
+  if (not valid[n])
+  { // make missing levels from the finest valid level
+    UTime t;
+    t.now();
+    int i = n;
+    while (not valid[i - 1])
+      i--;
+    for (; i <= n; i++)
+    { // same size as last frame, so buffer is reused
+      cv::pyrDown(level[i - 1], level[i]);
+      valid[i] = true;
+      buildCnt[i]++;
+    }
+    buildTime += t.getTimePassed();
+  }
+  return level[n];
+}
+
+int UImagePyramid::levelFor(float scale)
+{
+  int n = 0;
+  while (n < LEVEL_CNT - 1 and scaleOf(n + 1) >= scale - 1e-4)
+    n++;
+  return n;
+}
+
+void UImagePyramid::printStatus()
+{
+  lock_guard<mutex> guard(lock);
+  printf("# image pyramid: frame %d, %.1f ms spent making levels\n", frame, buildTime * 1000);
+  for (int i = 0; i < LEVEL_CNT; i++)
+    printf("#   level %d (%dx%d): %d requests, made %d times\n",
+           i, level[i].cols, level[i].rows, requestCnt[i], buildCnt[i]);
+}
@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef UIMAGEPYRAMID_H
+#define UIMAGEPYRAMID_H
+
+#include <mutex>
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+
+/**
+ * Image pyramid for the current camera frame, shared by all detectors.
+ * Level 0 is the full frame, each next level is half the size (Gaussian pyrDown).
+ * Levels are made on request only, and at most once per frame, so a detector
+ * can search a coarse level and refine candidate regions at full resolution,
+ * without each detector reducing the full frame by itself.
+ * The buffers are reused, so a level is valid until the next frame. */
+class UImagePyramid
+{
+public:
+  const static int LEVEL_CNT = 4;
+
+public:
+  /**
+   * New frame, all reduced levels are invalid
+   * \param im is the full resolution BGR frame (not copied)
+   * \param frame is the image number */
+  void setFrame(const cv::Mat &im, int frame);
+  /**
+   * Get a pyramid level, made now if not made for this frame
+   * \param level is 0 (full) to LEVEL_CNT-1 (1/8 size)
+   * \returns the image at this level, or an empty image if there is no frame */
+  cv::Mat get(int level);
+  /** size reduction at this level (1, 0.5, 0.25 ...) */
+  static float scaleOf(int level)
+  {
+    return 1.0 / (1 << level);
+  }
+  /** coarsest level with at least this scale (e.g. 0.35 gives level 1) */
+  static int levelFor(float scale);
+  /** print status */
+  void printStatus();
+
+private:
+  mutex lock;
+  cv::Mat level[LEVEL_CNT];
+  bool valid[LEVEL_CNT] = {false};
+  int frame = -1;
+  /// statistics
+  int requestCnt[LEVEL_CNT] = {0};
+  int buildCnt[LEVEL_CNT] = {0};
+  float buildTime = 0;
+};
+
+#endif
@@ -0,0 +1,234 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "ulineahead.h"
+#include "utime.h"
+
+float ULineAheadResult::speed(float vMin, float vMax, float aLat) const
+{
+  if (not found)
+    return vMin;
+  float v = vMax;
+  if (fabs(curvature) > 1e-3)
+    v = fminf(v, sqrt(aLat / fabs(curvature)));
+  // full speed only with 1m of line ahead, and no crossing within 1m
+  if (crossing >= 0)
+    v = fminf(v, vMin + (vMax - vMin) * fminf(crossing, 1.0));
+  v = fminf(v, vMin + (vMax - vMin) * fminf(range, 1.0));
+  return fmaxf(vMin, v);
+}
+
+void ULineAhead::makeMap(int cols, int rows, const cv::Mat &cameraMatrix,
+                         const cv::Mat &distortion, const cv::Mat &cam2robot)
+{
+  int nr = int((dMax - dMin) / dStep + 1.5);
+  int nc = int(2 * halfWidth / wStep + 1.5);
+  mapX.create(nr, nc, CV_32FC1);
+  mapY.create(nr, nc, CV_32FC1);
+  // pixel scale at this level
+  float s = UImagePyramid::scaleOf(level);
+  float fx = cameraMatrix.at<double>(0, 0), fy = cameraMatrix.at<double>(1, 1);
+  float cx = cameraMatrix.at<double>(0, 2), cy = cameraMatrix.at<double>(1, 2);
+  float k1 = distortion.at<double>(0, 0), k2 = distortion.at<double>(0, 1);
+  float p1 = distortion.at<double>(0, 2), p2 = distortion.at<double>(0, 3);
+  float k3 = distortion.at<double>(0, 4);
+  // robot to camera: pc = R' (pr - t)
+  float R[3][3], tr[3];
+  for (int i = 0; i < 3; i++)
+  {
+    for (int j = 0; j < 3; j++)
+      R[i][j] = cam2robot.at<float>(i, j);
+    tr[i] = cam2robot.at<float>(i, 3);
+  }
+  for (int r = 0; r < nr; r++)
+  { // row 0 is nearest
+    float fwd = dMin + r * dStep;
+    for (int c = 0; c < nc; c++)
+    { // column 0 is left
+      float left = halfWidth - c * wStep;
+      float d[3] = {fwd - tr[0], left - tr[1], -tr[2]};
+      float pc[3];
+      for (int i = 0; i < 3; i++)
+        pc[i] = R[0][i] * d[0] + R[1][i] * d[1] + R[2][i] * d[2];
+      float u = -1, v = -1;
+      if (pc[2] > 0.05)
+      { // in front of camera, distorted pixel position
+        float x = pc[0] / pc[2], y = pc[1] / pc[2];
+        float r2 = x * x + y * y;
+        float k = 1 + k1 * r2 + k2 * r2 * r2 + k3 * r2 * r2 * r2;
+        float xd = x * k + 2 * p1 * x * y + p2 * (r2 + 2 * x * x);
+        float yd = y * k + p1 * (r2 + 2 * y * y) + 2 * p2 * x * y;
+        // pixel centre at reduced level
+        u = (fx * xd + cx + 0.5) * s - 0.5;
+        v = (fy * yd + cy + 0.5) * s - 0.5;
+        if (u < 0 or u > cols - 1 or v < 0 or v > rows - 1)
+          u = v = -1;
+      }
+      mapX.at<float>(r, c) = u;
+      mapY.at<float>(r, c) = v;
+    }
+  }
+  mapCols = cols;
+  mapRows = rows;
+}
+
+bool ULineAhead::process(UImagePyramid &pyr, int frame, double t, const cv::Mat &cameraMatrix,
+                         const cv::Mat &distortion, const cv::Mat &cam2robot, int calibVersion)
+{
+  UTime tm;
+  tm.now();
+  cv::Mat im = pyr.get(level);
+  if (im.empty())
+    // no frame
+    return false;
+  if (im.cols != mapCols or im.rows != mapRows or calibVersion != mapVersion)
+  { // e.g. new camera tilt
+    makeMap(im.cols, im.rows, cameraMatrix, distortion, cam2robot);
+    mapVersion = calibVersion;
+  }
+  // ground grid image (outside image is black)
+  cv::remap(im, ground, mapX, mapY, cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0, 0, 0));
+  cv::cvtColor(ground, groundGrey, cv::COLOR_BGR2GRAY);
+  ULineAheadResult res;
+  res.frame = frame;
+  res.t = t;
+  // least squares sums for left = a + b d + c d^2
+  double S[5] = {0}, Sy[3] = {0};
+  int n = 0;
+  // search near the last position (start at robot centre line)
+  int last = groundGrey.cols / 2;
+  for (int r = 0; r < groundGrey.rows; r++)
+  {
+    const uchar *g = groundGrey.ptr<uchar>(r);
+    int mx = 0, sum = 0;
+    for (int c = 0; c < groundGrey.cols; c++)
+    {
+      sum += g[c];
+      mx = max(mx, (int)g[c]);
+    }
+    int mean = sum / groundGrey.cols;
+    if (mx - mean < minContrast)
+      continue;
+    int thr = (mx + mean) / 2;
+    // bright run nearest the last position
+    int best = -1, bestDist = 1000, bestW = 0;
+    float bestPos = 0;
+    for (int c = 0; c < groundGrey.cols;)
+    {
+      if (g[c] <= thr)
+      {
+        c++;
+        continue;
+      }
+      int c0 = c;
+      float w = 0, wc = 0;
+      for (; c < groundGrey.cols and g[c] > thr; c++)
+      {
+        w += g[c] - thr;
+        wc += (g[c] - thr) * c;
+      }
+      float pos = wc / w;
+      int dist = abs(int(pos) - last);
+      if (dist < bestDist)
+      {
+        best = c0;
+        bestDist = dist;
+        bestW = c - c0;
+        bestPos = pos;
+      }
+    }
+    if (best < 0)
+      continue;
+    float d = dMin + r * dStep;
+    if (bestW * wStep > crossWidth)
+    { // crossing (first one only), but not a line position
+      if (res.crossing < 0)
+        res.crossing = d;
+      continue;
+    }
+    float left = halfWidth - bestPos * wStep;
+    last = bestPos;
+    double dp = 1;
+    for (int i = 0; i < 5; i++)
+    {
+      S[i] += dp;
+      if (i < 3)
+        Sy[i] += dp * left;
+      dp *= d;
+    }
+    res.range = d;
+    n++;
+  }
+  if (n >= 3)
+  { // solve 3x3 normal equations (Cramer)
+    double A[3][3] = {{S[0], S[1], S[2]}, {S[1], S[2], S[3]}, {S[2], S[3], S[4]}};
+    double det = A[0][0] * (A[1][1] * A[2][2] - A[1][2] * A[2][1]) -
+                 A[0][1] * (A[1][0] * A[2][2] - A[1][2] * A[2][0]) +
+                 A[0][2] * (A[1][0] * A[2][1] - A[1][1] * A[2][0]);
+    if (fabs(det) > 1e-12)
+    {
+      double x[3];
+      for (int k = 0; k < 3; k++)
+      { // replace column k with Sy
+        double B[3][3];
+        for (int i = 0; i < 3; i++)
+          for (int j = 0; j < 3; j++)
+            B[i][j] = j == k ? Sy[i] : A[i][j];
+        x[k] = (B[0][0] * (B[1][1] * B[2][2] - B[1][2] * B[2][1]) -
+                B[0][1] * (B[1][0] * B[2][2] - B[1][2] * B[2][0]) +
+                B[0][2] * (B[1][0] * B[2][1] - B[1][1] * B[2][0])) / det;
+      }
+      res.offset = x[0];
+      res.slope = x[1];
+      res.bend = x[2];
+      res.heading = atan(res.slope);
+      res.curvature = 2 * res.bend / pow(1 + res.slope * res.slope, 1.5);
+      res.found = true;
+    }
+  }
+  lock_guard<mutex> guard(lock);
+  result = res;
+  frameCnt++;
+  foundCnt += res.found;
+  crossingCnt += res.crossing >= 0;
+  time += tm.getTimePassed();
+  return res.found;
+}
+
+ULineAheadResult ULineAhead::get()
+{
+  lock_guard<mutex> guard(lock);
+  return result;
+}
+
+void ULineAhead::printStatus()
+{
+  lock_guard<mutex> guard(lock);
+  printf("# line look-ahead: %.2f to %.2fm (+/-%.2fm) at pyramid level %d, %.2f ms per frame\n",
+         dMin, dMax, halfWidth, level, frameCnt > 0 ? time / frameCnt * 1000 : 0);
+  printf("#   %d frames, line in %d, crossing in %d\n", frameCnt, foundCnt, crossingCnt);
+  if (result.found)
+    printf("#   last: offset %.3fm, heading %.1fdeg, curvature %.2f/m, range %.2fm, crossing %.2fm\n",
+           result.offset, result.heading * 180 / M_PI, result.curvature, result.range, result.crossing);
+}
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef ULINEAHEAD_H
+#define ULINEAHEAD_H
+
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include "uimagepyramid.h"
+
+using namespace std;
+
+/**
+ * Line seen ahead of the robot (robot coordinates, x=fwd, y=left) */
+struct ULineAheadResult
+{
+  /// image number and time [sec]
+  int frame = -1;
+  double t = 0;
+  /// a line is found (in at least 3 distance rows)
+  bool found = false;
+  /// line fit: left = offset + slope * fwd + bend * fwd^2 [m]
+  float offset = 0, slope = 0, bend = 0;
+  /// line heading at the robot [rad] and curvature [1/m, positive is turning left]
+  float heading = 0, curvature = 0;
+  /// farthest distance with line [m]
+  float range = 0;
+  /// distance to a crossing (wide white area) [m], -1 if none is seen
+  float crossing = -1;
+  /**
+   * Speed for this line ahead
+   * \param vMin is speed for a sharp turn or a crossing just ahead (or no line)
+   * \param vMax is speed for a straight line without crossing
+   * \param aLat is allowed lateral acceleration in curves [m/s^2]
+   * \returns speed [m/s] */
+  float speed(float vMin, float vMax, float aLat) const;
+};
+
+/**
+ * Camera line look-ahead.
+ * A ground area in front of the robot (a grid of distance rows and lateral
+ * columns) is projected into the image once (camera matrix, distortion and
+ * cam2robot - again if the image size or calibration changes), so each frame is just a remap of these few pixels from a
+ * reduced image (pyramid level), then each row is searched for the white line.
+ * Line positions are fitted with a 2nd order polynomial (heading and curvature),
+ * a row with a line much wider than the line is a crossing. */
+class ULineAhead
+{
+public:
+  /// ground area [m]: distance from robot centre and lateral half width
+  float dMin = 0.25, dMax = 1.0, dStep = 0.05;
+  float halfWidth = 0.25, wStep = 0.01;
+  /// line wider than this is a crossing [m]
+  float crossWidth = 0.08;
+  /// minimum grey level difference line to floor
+  int minContrast = 30;
+  /// pyramid level used
+  int level = 2;
+
+public:
+  /**
+   * Find line in current frame
+   * \param pyr is image pyramid of current frame
+   * \param frame, t is image number and time
+   * \param cameraMatrix, distortion, cam2robot is camera calibration (full resolution)
+   * \param calibVersion is changed when the calibration is changed (the map is then remade)
+   * \returns true if a line is found */
+  bool process(UImagePyramid &pyr, int frame, double t, const cv::Mat &cameraMatrix,
+               const cv::Mat &distortion, const cv::Mat &cam2robot, int calibVersion);
+  /** latest result */
+  ULineAheadResult get();
+  /** print status */
+  void printStatus();
+
+private:
+  /** project ground grid to image pixels at the used pyramid level */
+  void makeMap(int cols, int rows, const cv::Mat &cameraMatrix,
+               const cv::Mat &distortion, const cv::Mat &cam2robot);
+  //
+  mutex lock;
+  ULineAheadResult result;
+  /// ground grid to pixel maps (made once) and work images
+  cv::Mat mapX, mapY;
+  cv::Mat ground, groundGrey;
+  int mapCols = 0, mapRows = 0, mapVersion = -1;
+  /// statistics
+  int frameCnt = 0, foundCnt = 0, crossingCnt = 0;
+  float time = 0;
+};
+
+#endif
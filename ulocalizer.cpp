@@ -0,0 +1,318 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cmath>
+#include <cstring>
+#include "ulocalizer.h"
+
+ULocalizer::ULocalizer()
+{
+  reset();
+}
+
+ULocalizer::~ULocalizer()
+{
+  closeLog();
+}
+
+void ULocalizer::reset()
+{
+  lock_guard<mutex> guard(lock);
+  for (int i = 0; i < 3; i++)
+  {
+    c[i] = 0;
+    for (int j = 0; j < 3; j++)
+      P[i][j] = 0;
+  }
+  // start pose is known (1 cm and 1 degree)
+  P[0][0] = P[1][1] = 0.01 * 0.01;
+  P[2][2] = pow(M_PI / 180, 2);
+}
+
+int ULocalizer::loadMap(const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (f == NULL)
+  {
+    printf("# ULocalizer:: no landmark map '%s', pose correction is off\n", filename);
+    return 0;
+  }
+  const int MSL = 200;
+  char s[MSL];
+  int n = 0;
+  while (fgets(s, MSL, f) != NULL)
+  {
+    int id;
+    float a[3];
+    if (s[0] == '%')
+      continue;
+    if (sscanf(s, "marker %d %f %f %f", &id, &a[0], &a[1], &a[2]) == 4)
+    {
+      addLandmark(id, a[0], a[1], a[2]);
+      n++;
+    }
+  }
+  fclose(f);
+  printf("# ULocalizer:: loaded %d landmarks from '%s'\n", n, filename);
+  return n;
+}
+
+void ULocalizer::addLandmark(int id, float x, float y, float hDeg)
+{
+  lock_guard<mutex> guard(lock);
+  ULandmark lm = {id, x, y, float(hDeg * M_PI / 180)};
+  for (auto &l : landmarks)
+    if (l.id == id)
+    {
+      l = lm;
+      return;
+    }
+  landmarks.push_back(lm);
+}
+
+void ULocalizer::odometry(const float *pose)
+{
+  lock_guard<mutex> guard(lock);
+  if (odoValid)
+  {
+    float dd = hypot(pose[0] - odo[0], pose[1] - odo[1]);
+    float dh = fabs(remainder(pose[2] - odo[2], 2 * M_PI));
+    if (dd > 0 or dh > 0)
+    { // world pose noise at the current position to correction noise
+      // (a heading error here does not move the robot, but moves the odometry origin)
+      float qd = pow(sdDist * dd, 2);
+      float qh = pow(sdHeadDist * dd, 2) + pow(sdTurn * dh, 2);
+      float co = cos(c[2]), si = sin(c[2]);
+      float a = si * pose[0] + co * pose[1];  // y - cy
+      float b = -co * pose[0] + si * pose[1]; // -(x - cx)
+      P[0][0] += qd + a * a * qh;
+      P[1][1] += qd + b * b * qh;
+      P[0][1] += a * b * qh;
+      P[0][2] += a * qh;
+      P[1][2] += b * qh;
+      P[2][2] += qh;
+      P[1][0] = P[0][1];
+      P[2][0] = P[0][2];
+      P[2][1] = P[1][2];
+    }
+  }
+  for (int i = 0; i < 3; i++)
+    odo[i] = pose[i];
+  odoValid = true;
+}
+
+int ULocalizer::update(const vector<UArUcoMarker> &markers, const float *pose, double t)
+{
+  lock_guard<mutex> guard(lock);
+  int n = 0;
+  for (auto &mk : markers)
+  {
+    const ULandmark *lm = NULL;
+    for (auto &l : landmarks)
+      if (l.id == mk.id)
+        lm = &l;
+    if (lm == NULL)
+    {
+      unknownCnt++;
+      continue;
+    }
+    int m = 2;
+    if (mk.distance < headDist)
+      m = 3;
+    if (updateOne(*lm, mk, m, pose, t))
+      n++;
+  }
+  return n;
+}
+
+bool ULocalizer::updateOne(const ULandmark &lm, const UArUcoMarker &mk, int m, const float *pose, double t)
+{
+  // world pose of robot at image time
+  float co = cos(c[2]), si = sin(c[2]);
+  float x = c[0] + co * pose[0] - si * pose[1];
+  float y = c[1] + si * pose[0] + co * pose[1];
+  float h = pose[2] + c[2];
+  // predicted measurement (marker fwd, left and normal direction relative to robot)
+  float dx = lm.x - x, dy = lm.y - y;
+  float ch = cos(h), sh = sin(h);
+  float fwd = ch * dx + sh * dy;
+  float left = -sh * dx + ch * dy;
+  float v[3];
+  v[0] = mk.x - fwd;
+  v[1] = mk.y - left;
+  v[2] = remainder(mk.heading - (lm.h - h), 2 * M_PI);
+  // measurement Jacobian for robot pose, then for correction
+  float Hp[3][3] = {{-ch, -sh, left}, {sh, -ch, -fwd}, {0, 0, -1}};
+  float H[3][3];
+  for (int i = 0; i < m; i++)
+  {
+    H[i][0] = Hp[i][0];
+    H[i][1] = Hp[i][1];
+    H[i][2] = -Hp[i][0] * (y - c[1]) + Hp[i][1] * (x - c[0]) + Hp[i][2];
+  }
+  // S = H P H' + R
+  float PHt[3][3], S[3][3];
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < m; j++)
+      PHt[i][j] = P[i][0] * H[j][0] + P[i][1] * H[j][1] + P[i][2] * H[j][2];
+  float sd = sdPos + sdPosDist * mk.distance;
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < m; j++)
+      S[i][j] = H[i][0] * PHt[0][j] + H[i][1] * PHt[1][j] + H[i][2] * PHt[2][j];
+  S[0][0] += sd * sd;
+  S[1][1] += sd * sd;
+  if (m == 3)
+    S[2][2] += sdHead * sdHead;
+  // inverse of S (2x2 or 3x3)
+  float Si[3][3];
+  if (m == 2)
+  {
+    float det = S[0][0] * S[1][1] - S[0][1] * S[1][0];
+    if (fabs(det) < 1e-12)
+      return false;
+    Si[0][0] = S[1][1] / det;
+    Si[1][1] = S[0][0] / det;
+    Si[0][1] = -S[0][1] / det;
+    Si[1][0] = -S[1][0] / det;
+  }
+  else
+  {
+    float det = S[0][0] * (S[1][1] * S[2][2] - S[1][2] * S[2][1]) -
+                S[0][1] * (S[1][0] * S[2][2] - S[1][2] * S[2][0]) +
+                S[0][2] * (S[1][0] * S[2][1] - S[1][1] * S[2][0]);
+    if (fabs(det) < 1e-12)
+      return false;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+      { // adjugate (cofactors transposed)
+        int r0 = (j + 1) % 3, r1 = (j + 2) % 3;
+        int c0 = (i + 1) % 3, c1 = (i + 2) % 3;
+        Si[i][j] = (S[r0][c0] * S[r1][c1] - S[r0][c1] * S[r1][c0]) / det;
+      }
+  }
+  // innovation gate (chi-square 99%, 2 or 3 degrees of freedom)
+  float d2 = 0;
+  for (int i = 0; i < m; i++)
+    for (int j = 0; j < m; j++)
+      d2 += v[i] * Si[i][j] * v[j];
+  bool used = d2 < (m == 2 ? 9.21 : 11.34);
+  if (used)
+  { // K = P H' S^-1, c += K v, P = (I - K H) P
+    float K[3][3];
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < m; j++)
+      {
+        K[i][j] = 0;
+        for (int k = 0; k < m; k++)
+          K[i][j] += PHt[i][k] * Si[k][j];
+      }
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < m; j++)
+        c[i] += K[i][j] * v[j];
+    c[2] = remainder(c[2], 2 * M_PI);
+    float Pn[3][3];
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+      { // K H P = K (P H')'
+        float khp = 0;
+        for (int k = 0; k < m; k++)
+          khp += K[i][k] * PHt[j][k];
+        Pn[i][j] = P[i][j] - khp;
+      }
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        P[i][j] = (Pn[i][j] + Pn[j][i]) / 2;
+    updateCnt++;
+    rejectRun = 0;
+  }
+  else
+  {
+    rejectCnt++;
+    if (++rejectRun >= maxRejectRun)
+    { // markers agree with each other, but not with the estimate
+      P[0][0] += 0.25 * 0.25;
+      P[1][1] += 0.25 * 0.25;
+      P[2][2] += pow(10 * M_PI / 180, 2);
+      rejectRun = 0;
+      inflateCnt++;
+    }
+  }
+  if (log != NULL)
+    fprintf(log, "%.3f %d %d %.3f %.3f %.4f %.2f %d %.3f %.3f %.4f %.3f %.3f %.4f\n",
+            t, mk.id, m, v[0], v[1], m == 3 ? v[2] : 0, d2, used, c[0], c[1], c[2],
+            sqrt(P[0][0]), sqrt(P[1][1]), sqrt(P[2][2]));
+  return used;
+}
+
+void ULocalizer::toWorld(const float *pose, float *world)
+{
+  lock_guard<mutex> guard(lock);
+  float co = cos(c[2]), si = sin(c[2]);
+  world[0] = c[0] + co * pose[0] - si * pose[1];
+  world[1] = c[1] + si * pose[0] + co * pose[1];
+  world[2] = remainder(pose[2] + c[2], 2 * M_PI);
+}
+
+float ULocalizer::toOdoHeading(float worldDeg)
+{
+  lock_guard<mutex> guard(lock);
+  return remainder(worldDeg - c[2] * 180 / M_PI, 360);
+}
+
+void ULocalizer::openLog(const char *date)
+{
+  const int MNL = 100;
+  char name[MNL];
+  snprintf(name, MNL, "log_localizer_%s.txt", date);
+  log = fopen(name, "w");
+  if (log != NULL)
+  {
+    fprintf(log, "%% landmark updates (%d landmarks)\n", (int)landmarks.size());
+    fprintf(log, "%% 1 image time [sec]\n");
+    fprintf(log, "%% 2 marker ID\n");
+    fprintf(log, "%% 3 measurement size (2 = position, 3 = with marker normal)\n");
+    fprintf(log, "%% 4,5,6 innovation (fwd, left, normal) [m,m,rad]\n");
+    fprintf(log, "%% 7 normalized innovation squared\n");
+    fprintf(log, "%% 8 used (0 = rejected by gate)\n");
+    fprintf(log, "%% 9,10,11 correction odometry to world (x, y, h) [m,m,rad]\n");
+    fprintf(log, "%% 12,13,14 correction standard deviation (x, y, h) [m,m,rad]\n");
+  }
+  else
+    printf("# ULocalizer:: failed to open %s\n", name);
+}
+
+void ULocalizer::closeLog()
+{
+  if (log != NULL)
+  {
+    fclose(log);
+    log = NULL;
+  }
+}
+
+void ULocalizer::printStatus()
+{
+  lock_guard<mutex> guard(lock);
+  printf("# localizer: %d landmarks, %d updates, %d rejected (%d times reset), %d unknown markers\n",
+         (int)landmarks.size(), updateCnt, rejectCnt, inflateCnt, unknownCnt);
+  printf("#   correction x=%.3f y=%.3f h=%.1fdeg (sd %.3f %.3f %.1fdeg)\n",
+         c[0], c[1], c[2] * 180 / M_PI, sqrt(P[0][0]), sqrt(P[1][1]), sqrt(P[2][2]) * 180 / M_PI);
+}
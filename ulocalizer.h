@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef ULOCALIZER_H
+#define ULOCALIZER_H
+
+#include <cstdio>
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include "uarucotrack.h"
+
+using namespace std;
+
+/**
+ * A marker with known position in the world */
+struct ULandmark
+{
+  int id;
+  /// marker centre [m] and direction of marker normal (out of the marker front) [rad]
+  float x, y, h;
+};
+
+/**
+ * Pose correction from ArUco markers with known world position (landmarks).
+ * The state is the correction from odometry to world coordinates (x, y, h),
+ * estimated by an extended Kalman filter: the uncertainty grows with the
+ * distance driven and the angle turned, and each marker detection is an update
+ * with its robot relative position (and marker normal direction, when close).
+ * As the correction changes slowly, it applies to the odometry pose at any time,
+ * so detections taken at image time and the corrected pose at full pose rate
+ * need no buffering. Each update is a fixed size 3x3 calculation.
+ * The landmark map is a file with lines 'marker id x y h', h in degrees,
+ * lines starting with '%' are comments. */
+class ULocalizer
+{
+public:
+  /// odometry position error per meter driven [m/m]
+  float sdDist = 0.02;
+  /// odometry heading error per meter driven [rad/m] and per radian turned [rad/rad]
+  float sdHeadDist = 0.02;
+  float sdTurn = 0.02;
+  /// marker position error, fixed part [m] and part per meter distance [m/m]
+  float sdPos = 0.02;
+  float sdPosDist = 0.03;
+  /// marker normal direction error [rad], used only for markers closer than headDist [m]
+  float sdHead = 5 * M_PI / 180;
+  float headDist = 1.5;
+  /// after this many rejected markers in a row, the uncertainty is increased (odometry is worse than modelled)
+  int maxRejectRun = 10;
+
+public:
+  /** constructor */
+  ULocalizer();
+  /** destructor */
+  ~ULocalizer();
+  /**
+   * load landmark map
+   * \returns number of landmarks loaded */
+  int loadMap(const char *filename);
+  /** add (or replace) a landmark, h is in degrees */
+  void addLandmark(int id, float x, float y, float hDeg);
+  int landmarkCount()
+  {
+    return landmarks.size();
+  }
+  /**
+   * New odometry pose, the uncertainty is increased by the motion since last call
+   * \param pose is odometry pose (x, y, h) */
+  void odometry(const float *pose);
+  /**
+   * Update with markers found in one image
+   * \param markers is the markers found (markers not in the map are ignored)
+   * \param pose is the odometry pose at image time
+   * \param t is image time (for log)
+   * \returns number of markers used */
+  int update(const vector<UArUcoMarker> &markers, const float *pose, double t);
+  /**
+   * Corrected pose
+   * \param pose is odometry pose (x, y, h)
+   * \param world is set to world pose (x, y, h) */
+  void toWorld(const float *pose, float *world);
+  /**
+   * Odometry heading for a world heading (both in degrees), e.g. for a 'head=' snippet line */
+  float toOdoHeading(float worldDeg);
+  /** reset correction (odometry is world) */
+  void reset();
+  /** log updates to localizer_[date].txt */
+  void openLog(const char *date);
+  void closeLog();
+  /** print status */
+  void printStatus();
+
+private:
+  /**
+   * Kalman update with one marker
+   * \param m is the measurement size (2 is position only, 3 is with marker normal)
+   * \returns true if used (not rejected by the innovation gate) */
+  bool updateOne(const ULandmark &lm, const UArUcoMarker &mk, int m, const float *pose, double t);
+  //
+  mutex lock;
+  vector<ULandmark> landmarks;
+  /// correction from odometry to world (x, y, h) and its covariance
+  float c[3] = {0};
+  float P[3][3];
+  /// last odometry pose
+  float odo[3] = {0};
+  bool odoValid = false;
+  /// statistics
+  int updateCnt = 0, rejectCnt = 0, unknownCnt = 0;
+  int rejectRun = 0, inflateCnt = 0;
+  FILE *log = NULL;
+};
+
+#endif
@@ -9,6 +9,7 @@
 
 #include <sys/time.h>
 #include <cstdlib>
+#include <time.h>
 
 #include "umission.h"
 #include "utime.h"
@@ -18,7 +19,9 @@ UMission::UMission(UBridge *regbot, UCamera *camera)
 {
   cam = camera;
   bridge = regbot;
-  threadActive = 100;
+  // all snippet threads are unused
+  for (int i = 0; i < snippetThreadCnt; i++)
+    snippetState[i] = SNIPPET_FREE;
   // initialize line list to empty
   for (int i = 0; i < missionLineMax; i++)
   { // add to line list
@@ -26,6 +29,38 @@ UMission::UMission(UBridge *regbot, UCamera *camera)
     // terminate c-strings strings - good practice, but not needed
     lines[i][0] = '\0';
   }
+  if (cam != NULL)
+  {
+    objects = cam->objects;
+    recorder = cam->recorder;
+  }
+  else
+  { // simulated detections are mapped by the mission
+    objects = new UObjectMap();
+    ownObjects = true;
+  }
+  notify = new UNotify(&play);
+  channel = new UCmdChannel(bridge);
+  safety = new USafety(bridge, channel);
+  subscriptions = new USubscriptions(bridge);
+  // streams read in all missions: events, heartbeat, gamepad (manual override),
+  // IR for the safety monitor and pose for the state log, localizer and turns
+  subscriptions->always(USubscriptions::SUB_EVENT);
+  subscriptions->always(USubscriptions::SUB_INFO);
+  subscriptions->always(USubscriptions::SUB_JOY);
+  subscriptions->always(USubscriptions::SUB_IRDIST);
+  subscriptions->always(USubscriptions::SUB_POSE);
+  // mission 4 follows the lead robot by IR and own velocity
+  subscriptions->need(4, USubscriptions::SUB_MOTOR);
+  safetyIrFront = safety->addPredicate(USafety::SRC_IR2, true, 0.2, "ir2 front");
+  // all predicates are added
+  safety->start();
+  localizer = new ULocalizer();
+  if (localizer->loadMap("markers.txt") > 0 and cam != NULL)
+  { // markers are needed on every frame
+    cam->arucoTracking = true;
+    cam->doArUcoContinuous = true;
+  }
   // start mission thread
   th1 = new thread(runObj, this);
 }
@@ -33,6 +68,17 @@ UMission::UMission(UBridge *regbot, UCamera *camera)
 UMission::~UMission()
 {
   printf("Mission class destructor\n");
+  if (telemetry != NULL)
+    delete telemetry;
+  delete safety;
+  delete subscriptions;
+  delete localizer;
+  delete notify;
+  delete channel;
+  if (traffic != NULL)
+    delete traffic;
+  if (ownObjects)
+    delete objects;
 }
 
 void UMission::run()
@@ -50,6 +96,29 @@ void UMission::printStatus()
   printf("# ------- Mission ----------\n");
   printf("# active = %d, finished = %d\n", active, finished);
   printf("# mission part=%d, in state=%d\n", mission, missionState);
+  printf("# snippet threads (%d from %d):", snippetThreadCnt, snippetThreadFirst);
+  for (int i = 0; i < snippetThreadCnt; i++)
+  {
+    const char *st = "free";
+    if (snippetState[i] == SNIPPET_ACTIVE)
+      st = "active";
+    else if (snippetState[i] == SNIPPET_PRELOADED)
+      st = "preloaded";
+    printf(" %d=%s", snippetThreadFirst + i, st);
+  }
+  printf("\n");
+  startup.print();
+  transitions.printStatus();
+  notify->printStatus();
+  channel->printStatus();
+  safety->printStatus();
+  subscriptions->printStatus();
+  localizer->printStatus();
+  gapFollow.printStatus();
+  if (telemetry != NULL)
+    telemetry->printStatus();
+  if (traffic != NULL)
+    traffic->printStatus();
 }
 
 /**
@@ -57,95 +126,496 @@ void UMission::printStatus()
  * It further initializes a (maximum) number of mission lines 
  * in the REGBOT microprocessor. */
 void UMission::missionInit()
-{ // stop any not-finished mission
-  bridge->send("robot stop\n");
-  // clear old mission
-  bridge->send("robot <clear\n");
+{
   //
-  // add new mission with 3 threads
-  // one (100) starting at event 30 and stopping at event 31
-  // one (101) starting at event 31 and stopping at event 30
+  // add new mission with a pool of snippet threads
+  // thread 100+i starting at event 28+i and stopping when
+  // any of the other pool threads (or the safety hold thread) are started
   // one (  1) used for idle and initialisation of hardware
   // the mission is started, but staying in place (velocity=0, so servo action)
   //
-  bridge->send("robot <add thread=1\n");
+  // the program is uploaded a thread at a time, as one bridge message,
+  // rather than one message per line
+  const int MBL = (missionLineMax + 2) * 40;
+  char b[MBL];
+  // stop any not-finished mission, and clear old mission
+  int n = snprintf(b, MBL, "robot stop\nrobot <clear\n");
+  n += snprintf(&b[n], MBL - n, "robot <add thread=1\n");
   // Irsensor should be activated a good time before use
   // otherwise first samples will produce "false" positive (too short/negative).
-  bridge->send("robot <add irsensor=1,vel=0:dist<0.2\n");
+  snprintf(&b[n], MBL - n, "robot <add irsensor=1,vel=0:dist<0.2\n");
+  send(b);
   //
-  // alternating threads (100 and 101, alternating on event 30 and 31 (last 2 events)
-  bridge->send("robot <add thread=100,event=30 : event=31\n");
-  for (int i = 0; i < missionLineMax; i++)
-    // send placeholder lines, that will never finish
-    // are to be replaced with real mission
-    // NB - hereafter no lines can be added to these threads, just modified
-    bridge->send("robot <add vel=0 : time=0.1\n");
-  //
-  bridge->send("robot <add thread=101,event=31 : event=30\n");
-  for (int i = 0; i < missionLineMax; i++)
-    // send placeholder lines, that will never finish
-    bridge->send("robot <add vel=0 : time=0.1\n");
-  usleep(10000);
-  //
-  //
-  // send subscribe to bridge
-  bridge->pose->subscribe();
-  bridge->edge->subscribe();
-  bridge->motor->subscribe();
-  bridge->event->subscribe();
-  bridge->joy->subscribe();
-  bridge->motor->subscribe();
-  bridge->info->subscribe();
-  bridge->irdist->subscribe();
-  bridge->imu->subscribe();
-  usleep(10000);
-  // there maybe leftover events from last mission
-  bridge->event->clearEvents();
+  // pool threads, only one is running at any time
+  for (int t = 0; t < snippetThreadCnt; t++)
+  { // start at own event, stop at any of the other events (conditions are or'ed)
+    n = snprintf(b, MBL, "robot <add thread=%d,event=%d :", snippetThreadFirst + t, snippetEventFirst + t);
+    const char *sep = " ";
+    for (int e = 0; e < snippetThreadCnt; e++)
+    {
+      if (e != t)
+      {
+        n += snprintf(&b[n], MBL - n, "%sevent=%d", sep, snippetEventFirst + e);
+        sep = ", ";
+      }
+    }
+    n += snprintf(&b[n], MBL - n, ", event=%d\n", safety->holdEvent);
+    for (int i = 0; i < missionLineMax; i++)
+      // send placeholder lines, that will never finish
+      // are to be replaced with real mission
+      // NB - hereafter no lines can be added to these threads, just modified
+      n += snprintf(&b[n], MBL - n, "robot <add vel=0 : time=0.1\n");
+    send(b);
+    snippetState[t] = SNIPPET_FREE;
+  }
+  snippetActive = -1;
+  // hold thread for the safety monitor, stops at once and waits
+  // until the mission starts a new snippet
+  n = snprintf(b, MBL, "robot <add thread=%d,event=%d :", safetyHoldThread, safety->holdEvent);
+  for (int e = 0; e < snippetThreadCnt; e++)
+    n += snprintf(&b[n], MBL - n, "%sevent=%d", e == 0 ? " " : ", ", snippetEventFirst + e);
+  n += snprintf(&b[n], MBL - n, "\n");
+  snprintf(&b[n], MBL - n, "robot <add vel=0, acc=5 : time=1000\n");
+  send(b);
+  // streams needed by all missions, from before the first mission starts
+  // (events are cleared when the bridge is ready)
+  subscriptions->setMission(0);
+}
+
+bool UMission::waitForBridge(float timeout)
+{
+  if (sim != NULL)
+    return true;
+  double t0 = timeNow();
+  while (not bridge->info->isHeartbeatOK() and not th1stop)
+  { // heartbeat should come at least once a second
+    if (timeNow() - t0 > timeout)
+      return false;
+    usleep(5000);
+  }
+  return bridge->info->isHeartbeatOK();
 }
 
 void UMission::sendAndActivateSnippet(char **missionLines, int missionLineCnt)
 {
-  // Calling sendAndActivateSnippet automatically toggles between thread 100 and 101.
-  // Modifies the currently inactive thread and then makes it active.
+  // Uploads to a dormant pool thread and then makes it active.
+  transitions.decision(timeNow());
+  // no status to the display until activated
+  channel->uploadBegin();
+  int snippet = preloadSnippet(missionLines, missionLineCnt);
+  if (snippet < 0)
+  { // this snippet is to run now, so the preloaded snippets are not needed
+    printf("# UMission::sendAndActivateSnippet: preloaded snippets released\n");
+    releasePreloadedSnippets();
+    snippet = preloadSnippet(missionLines, missionLineCnt);
+  }
+  activateSnippet(snippet);
+  channel->uploadEnd();
+}
+
+int UMission::preloadSnippet(char **missionLines, int missionLineCnt)
+{
   const int MSL = 100;
   char s[MSL];
-  int threadToMod = 101;
-  int startEvent = 31;
-  // select Regbot thread to modify
-  // and event to activate it
-  if (threadActive == 101)
+  int snippet = -1;
+  // select a free pool thread (a preloaded thread may still be activated)
+  for (int i = 0; i < snippetThreadCnt; i++)
   {
-    threadToMod = 100;
-    startEvent = 30;
+    if (snippetState[i] == SNIPPET_FREE)
+    {
+      snippet = i;
+      break;
+    }
+  }
+  if (snippet < 0)
+  {
+    printf("# UMission::preloadSnippet: no free REGBOT thread (release preloaded snippets first)\n");
+    return -1;
   }
+  int threadToMod = snippetThreadFirst + snippet;
   if (missionLineCnt > missionLineMax)
   {
     printf("# ----------- error - too many lines ------------\n");
     printf("# You tried to send %d lines, but there is buffer space for %d only!\n", missionLineCnt, missionLineMax);
-    printf("# set 'missionLineMax' to a higher number in 'umission.h' about line 57\n");
+    printf("# set 'missionLineMax' to a higher number in 'umission.h' about line 81\n");
     printf("# (not all lines will be send)\n");
     printf("# -----------------------------------------------\n");
     missionLineCnt = missionLineMax;
   }
+  transitions.uploadStart(timeNow());
+  channel->uploadBegin();
   // send mission lines using '<mod ...' command
   for (int i = 0; i < missionLineCnt; i++)
   { // send lines one at a time
     if (strlen((char *)missionLines[i]) > 0)
     { // send a modify line command
       snprintf(s, MSL, "<mod %d %d %s\n", threadToMod, i + 1, missionLines[i]);
-      bridge->send(s);
+      send(s);
     }
     else
       // an empty line will end code snippet too
       break;
   }
-  // let it sink in (10ms)
-  usleep(10000);
+  channel->uploadEnd();
+  transitions.uploadEnd(timeNow());
+  snippetState[snippet] = SNIPPET_PRELOADED;
+  snippetLoadTime[snippet].now();
+  return snippet;
+}
+
+void UMission::activateSnippet(int snippet)
+{
+  const int MSL = 100;
+  char s[MSL];
+  if (snippet < 0 or snippet >= snippetThreadCnt or snippetState[snippet] != SNIPPET_PRELOADED)
+  {
+    printf("# UMission::activateSnippet: snippet %d is not loaded - ignored\n", snippet);
+    return;
+  }
+  // let it sink in (10ms after upload), a snippet preloaded earlier needs no wait
+  float dt = snippetLoadTime[snippet].getTimePassed();
+  if (dt < 0.01)
+    pause(int((0.01 - dt) * 1e6));
   // Activate new snippet thread and stop the other
-  snprintf(s, MSL, "<event=%d\n", startEvent);
-  bridge->send(s);
-  // save active thread number
-  threadActive = threadToMod;
+  snprintf(s, MSL, "<event=%d\n", snippetEventFirst + snippet);
+  send(s);
+  float x, y, h;
+  getPose(x, y, h);
+  transitions.activated(timeNow(), mission, missionState, x, y, h);
+  // the stopped thread is free to be reused
+  if (snippetActive >= 0)
+    snippetState[snippetActive] = SNIPPET_FREE;
+  snippetState[snippet] = SNIPPET_ACTIVE;
+  snippetActive = snippet;
+}
+
+void UMission::releasePreloadedSnippets()
+{
+  for (int i = 0; i < snippetThreadCnt; i++)
+    if (snippetState[i] == SNIPPET_PRELOADED)
+      snippetState[i] = SNIPPET_FREE;
+}
+
+void UMission::send(const char *cmd)
+{
+  channel->send(cmd);
+}
+
+bool UMission::takeEvent(int event)
+{
+  bool isSet;
+  if (sim != NULL)
+    isSet = sim->isEventSet(event);
+  else
+    isSet = bridge->event->isEventSet(event);
+  if (isSet and traffic != NULL)
+    traffic->event(event);
+  if (isSet and telemetry != NULL)
+    telemetry->pushEvent(event);
+  return isSet;
+}
+
+bool UMission::isEventSet(int event)
+{
+  bool isSet = takeEvent(event);
+  if (isSet)
+    // start of the decide phase for the transition timing
+    transitions.eventSeen(timeNow());
+  return isSet;
+}
+
+void UMission::clearEvent(int event)
+{ // a stale event is not the start of a decision
+  takeEvent(event);
+}
+
+float UMission::irDist(int sensor)
+{
+  if (sim != NULL)
+    return sim->irdist[sensor];
+  return bridge->irdist->dist[sensor];
+}
+
+void UMission::pause(int us)
+{
+  if (sim != NULL)
+  {
+    sim->advance(us * 1e-6);
+    safety->check();
+    channel->pollStatus();
+  }
+  else
+    usleep(us);
+  if (traffic != NULL)
+    recordInputs();
+}
+
+void UMission::recordInputs()
+{
+  float v[3];
+  getPose(v[0], v[1], v[2]);
+  traffic->values(UTraffic::TR_POSE, v);
+  v[0] = irDist(0);
+  v[1] = irDist(1);
+  traffic->values(UTraffic::TR_IR, v);
+  v[0] = ownVel();
+  traffic->values(UTraffic::TR_VEL, v);
+}
+
+void UMission::recordTraffic(const char *filename)
+{
+  if (traffic == NULL)
+    traffic = new UTraffic();
+  if (traffic->start(filename, sim != NULL ? &sim->simTime : NULL))
+    channel->setTraffic(traffic);
+}
+
+bool UMission::safetyStop(int predicate)
+{
+  if (not safety->isTripped(predicate))
+    return false;
+  blackBox("safety stop");
+  // the running snippet is stopped by the hold thread
+  if (snippetActive >= 0)
+    snippetState[snippetActive] = SNIPPET_FREE;
+  snippetActive = -1;
+  return true;
+}
+
+double UMission::timeNow()
+{
+  if (sim != NULL)
+    return sim->simTime;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void UMission::getPose(float &x, float &y, float &h)
+{
+  if (sim != NULL)
+  {
+    x = sim->x;
+    y = sim->y;
+    h = sim->h;
+  }
+  else
+  {
+    x = bridge->pose->x;
+    y = bridge->pose->y;
+    h = bridge->pose->h;
+  }
+}
+
+void UMission::startBallDetection()
+{
+  if (sim != NULL)
+    // simulated detection is immediate
+    sim->detectBall(distanceToObject, angleToObject);
+  else
+  { // images are saved too (for debugging), a missing result is no ball
+    UVisionOptions opt;
+    opt.deadline = 2.0;
+    opt.saveImage = true;
+    ballJob = cam->submit(VJ_BALL, opt);
+  }
+}
+
+void UMission::startBallServo()
+{
+  float x, y;
+  if (sim == NULL)
+    cam->doBallServo = true;
+  getPose(x, y, servoHeading0);
+  servoLastSeen = timeNow();
+  servoLastFrame = -1;
+}
+
+void UMission::stopBallServo()
+{
+  if (sim == NULL)
+    cam->doBallServo = false;
+}
+
+int UMission::newBallObservation(float &distance, float &angle, float *pose)
+{
+  int frame;
+  bool found = false;
+  if (sim != NULL)
+  { // simulated camera at 10 frames per second
+    frame = int(sim->simTime * 10);
+    if (frame != servoLastFrame)
+    {
+      float p[3];
+      found = sim->detectBall(distance, angle);
+      getPose(p[0], p[1], p[2]);
+      if (found)
+      {
+        float a = angle * M_PI / 180;
+        objects->add(UObjectMap::OBJ_BALL, 0, distance / 1000 * cos(a), distance / 1000 * sin(a), p, mapTime());
+      }
+      if (pose != NULL)
+        for (int i = 0; i < 3; i++)
+          pose[i] = p[i];
+    }
+  }
+  else
+    found = cam->getBallServo(distance, angle, frame, pose);
+  if (frame == servoLastFrame)
+    return -1;
+  servoLastFrame = frame;
+  return found;
+}
+
+bool UMission::ballSighting(float distance, float angle, float *pose)
+{
+  if (distance <= 0 or distance > 1100)
+    return false;
+  // ball position in world coordinates
+  float a = pose[2] + angle * M_PI / 180;
+  float bx = pose[0] + distance / 1000 * cos(a);
+  float by = pose[1] + distance / 1000 * sin(a);
+  // the observation is fused into the map already
+  UMapObject ob;
+  if (objects->nearest(UObjectMap::OBJ_BALL, -1, bx, by, objects->fuseDist, mapTime(), ob))
+  {
+    scanBallX = ob.x;
+    scanBallY = ob.y;
+    scanHits = ob.hits;
+  }
+  return scanHits >= 3;
+}
+
+void UMission::approachBall(float bx, float by)
+{
+  int line = 0;
+  float x, y, h;
+  getPose(x, y, h);
+  float turn = atan2(by - y, bx - x) - h;
+  turn = atan2(sin(turn), cos(turn));
+  dist = hypot(bx - x, by - y) - 0.30;
+  clearEvent(1);
+  snprintf(lines[line++], MAX_LEN, "vel=0.2,acc=2,tr=0.0:turn=%.1f", turn * 180 / M_PI);
+  snprintf(lines[line++], MAX_LEN, "vel=0.2,acc=2 :dist=%.3f", dist);
+  snprintf(lines[line++], MAX_LEN, "vel=0, event=1:time=0.1");
+  sendAndActivateSnippet(lines, line);
+  // heading change relative to search heading is turned back after pickup
+  turn = h + turn - servoHeading0;
+  angle = atan2(sin(turn), cos(turn)) * 180 / M_PI;
+}
+
+void UMission::blackBox(const char *reason)
+{
+  if (recorder != NULL)
+    recorder->trigger(reason);
+}
+
+void UMission::localize(const float *pose)
+{
+  localizer->odometry(pose);
+  if (cam == NULL or localizer->landmarkCount() == 0)
+    return;
+  int frame;
+  float imPose[3];
+  cam->getArUcoMarkers(locMarkers, frame, imPose);
+  if (frame != locFrame)
+  { // new frame (with or without markers)
+    locFrame = frame;
+    if (not locMarkers.empty())
+      localizer->update(locMarkers, imPose, mapTime());
+  }
+}
+
+float UMission::ownVel()
+{
+  if (sim != NULL)
+    return sim->velocity();
+  return (bridge->motor->motorVel[0] + bridge->motor->motorVel[1]) / 2;
+}
+
+void UMission::measureLead()
+{ // IR update time and the lead timeout use the same clock as mapTime()
+  if (sim != NULL)
+    gapFollow.measureIr(irDist(1), ownVel(), mapTime());
+  else
+    gapFollow.measureIr(irDist(1), ownVel(), bridge->irdist->updTime.getDecSec());
+}
+
+void UMission::followLead()
+{
+  // the resend limit uses the same clock as the lead timeout
+  double t = mapTime();
+  measureLead();
+  // curvature of the line ahead may change while following
+  gapFollow.cruise = lineSpeed(0.4);
+  float v = gapFollow.velocity(t);
+  // large changes at once, small changes (e.g. to match the lead velocity) only after a while
+  float dv = fabs(v - followVel);
+  bool change = dv > 0.02 or (dv > 0.005 and t - followSent > 1.0) or ((v == 0) != (followVel == 0));
+  if (change and t - followSent > 0.2)
+  { // new velocity: a new snippet (same end condition), as
+    // a running line is not changed by a modify
+    int line = 0;
+    float x, y, h;
+    getPose(x, y, h);
+    float driven = hypot(x - followStart[0], y - followStart[1]);
+    if (driven < followLeadIn)
+      // still on the crossing, where the leg started
+      snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2, white=1, edger=0:dist=%.3f", v, followLeadIn - driven);
+    snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2, white=1, edger=0:xl>16", v);
+    snprintf(lines[line++], MAX_LEN, "event=4");
+    sendAndActivateSnippet(lines, line);
+    followVel = v;
+    followSent = t;
+  }
+}
+
+float UMission::lineSpeed(float vel)
+{
+  if (cam == NULL or not cam->doLineAhead)
+    return vel;
+  ULineAheadResult r = cam->lineAhead->get();
+  if (mapTime() - r.t > 0.3)
+    // too old
+    return vel;
+  return r.speed(vel, lineSpeedMax, 0.5);
+}
+
+float UMission::odoHead(float worldDeg)
+{
+  return localizer->toOdoHeading(worldDeg);
+}
+
+double UMission::mapTime()
+{
+  if (sim != NULL)
+    return sim->simTime;
+  UTime t;
+  t.now();
+  return t.getDecSec();
+}
+
+bool UMission::ballDetectionDone()
+{
+  if (sim != NULL)
+    return true;
+  if (ballJob == NULL)
+    return true;
+  if (not ballJob->isReady())
+    return false;
+  UVisionResult res = ballJob->get();
+  ballJob = NULL;
+  if (res.isOK() and res.found)
+  {
+    distanceToObject = res.distance;
+    angleToObject = res.angle;
+  }
+  else
+  {
+    distanceToObject = 0;
+    blackBox("no ball detected");
+  }
+  return true;
 }
 
 //////////////////////////////////////////////////////////
@@ -167,6 +637,8 @@ void UMission::runMission()
   bool ended = false;
   /// manuel override - using gamepad
   bool inManual = false;
+  /// blue button was pressed in last loop (dump once per press)
+  bool bluePressed = false;
   /// debug loop counter
   int loop = 0;
   // keeps track of mission state
@@ -176,22 +648,28 @@ void UMission::runMission()
   const int MSL = 120;
   char s[MSL];
   /// initialize robot mission to do nothing (wait for mission lines)
+  startup.begin = timeNow();
   missionInit();
-  /// start (the empty) mission, ready for mission snippets.
-  bridge->send("start\n"); // ask REGBOT to start controlled run (ready to execute)
-  bridge->send("oled 3 waiting for REGBOT\n");
-  ///
-  for (int i = 0; i < 3; i++)
-  {
-    if (not bridge->info->isHeartbeatOK())
-    { // heartbeat should come at least once a second
-      sleep(1);
-    }
+  startup.uploaded = timeNow();
+  channel->setStatus(3, "waiting for REGBOT");
+  bool bridgeOK = waitForBridge(3.0);
+  startup.heartbeat = timeNow();
+  if (bridgeOK)
+  { // there maybe leftover events from last mission
+    if (sim == NULL)
+      bridge->event->clearEvents();
+    else
+      sim->clearEvents();
+    /// start (the empty) mission, ready for mission snippets.
+    send("start\n"); // ask REGBOT to start controlled run (ready to execute)
+    if (traffic != NULL)
+      // inputs for the first loop pass
+      recordInputs();
   }
-  if (not bridge->info->isHeartbeatOK())
+  else
   { // heartbeat should come at least once a second
-    system("espeak \"Oops, no usable connection with robot.\" -ven+f4 -s130 -a60 2>/dev/null &");
-    bridge->send("oled 3 Oops: Lost REGBOT!");
+    notify->say("Oops, no usable connection with robot.", 60);
+    channel->setStatus(3, "Oops: Lost REGBOT!");
     printf("# ---------- error ------------\n");
     printf("# No heartbeat from robot. Bridge or REGBOT is stuck\n");
     printf("# You could try restart ROBOBOT bridge ('b' from mission console) \n");
@@ -203,23 +681,26 @@ void UMission::runMission()
   { // stay in this mission loop until finished
     loop++;
     // test for manuel override (joy is short for joystick or gamepad)
-    if (bridge->joy->manual)
+    if (sim == NULL and bridge->joy->manual)
     { // just wait, do not continue mission
       usleep(20000);
       if (not inManual)
-        system("espeak \"Mission paused.\" -ven+f4 -s130 -a40 2>/dev/null &");
+        notify->say("Mission paused.", 40);
       inManual = true;
-      bridge->send("oled 3 GAMEPAD control\n");
+      channel->setStatus(3, "GAMEPAD control");
     }
     else
     { // in auto mode
       if (not regbotStarted)
       { // wait for start event is received from REGBOT
         // - in response to 'bot->send("start\n")' earlier
-        if (bridge->event->isEventSet(33))
+        if (isEventSet(33))
         { // start mission (button pressed)
           //           printf("Mission::runMission: starting mission (part from %d to %d)\n", fromMission, toMission);
           regbotStarted = true;
+          startup.ready = timeNow();
+          startup.print();
+          subscriptions->setMission(mission);
         }
       }
       else
@@ -227,9 +708,10 @@ void UMission::runMission()
         if (inManual)
         { // just entered auto mode, so tell.
           inManual = false;
-          system("espeak \"Mission resuming.\" -ven+f4 -s130 -a40 2>/dev/null &");
-          bridge->send("oled 3 running AUTO\n");
+          notify->say("Mission resuming.", 40);
+          channel->setStatus(3, "running AUTO");
         }
+        transitions.loopStart(timeNow());
         switch (mission)
         {
         case 1: // running auto mission
@@ -249,19 +731,28 @@ void UMission::runMission()
           finished = true;
           break;
         }
+        { // first pose change after a snippet activation
+          float pose[3];
+          getPose(pose[0], pose[1], pose[2]);
+          transitions.testMotion(timeNow(), pose[0], pose[1], pose[2]);
+          localize(pose);
+          if (recorder != NULL)
+            recorder->addState(mapTime(), mission, missionState, pose);
+        }
         if (ended)
         { // start next mission part in state 0
           mission++;
           ended = false;
           missionState = 0;
+          subscriptions->setMission(mission);
         }
         // show current state on robot display
         if (mission != missionOld or missionState != missionStateOld)
         { // update small O-led display on robot - when there is a change
           UTime t;
           t.now();
-          snprintf(s, MSL, "oled 4 mission %d state %d\n", mission, missionState);
-          bridge->send(s);
+          snprintf(s, MSL, "mission %d state %d", mission, missionState);
+          channel->setStatus(4, s);
           if (logMission != NULL)
           {
             fprintf(logMission, "%ld.%03ld %d %d\n",
@@ -281,43 +772,58 @@ void UMission::runMission()
     // gamepad buttons 0=green, 1=red, 2=blue, 3=yellow, 4=LB, 5=RB, 6=back, 7=start, 8=Logitech, 9=A1, 10 = A2
     // gamepad axes    0=left-LR, 1=left-UD, 2=LT, 3=right-LR, 4=right-UD, 5=RT, 6=+LR, 7=+-UD
     // see also "ujoy.h"
-    if (bridge->joy->button[BUTTON_RED])
+    // (no gamepad in simulation)
+    if (sim == NULL and bridge->joy->button[BUTTON_RED])
     { // red button -> save image
-      if (not cam->saveImage)
+      if (saveJob == NULL or saveJob->isReady())
       {
         printf("UMission::runMission:: button 1 (red) pressed -> save image\n");
-        cam->saveImage = true;
+        saveJob = cam->submit(VJ_SAVE);
       }
     }
-    if (bridge->joy->button[BUTTON_YELLOW])
+    if (sim == NULL and bridge->joy->button[BUTTON_YELLOW])
     { // yellow button -> make ArUco analysis
-      if (not cam->doArUcoAnalysis)
+      if (arucoJob == NULL or arucoJob->isReady())
       {
         printf("UMission::runMission:: button 3 (yellow) pressed -> do ArUco\n");
-        cam->doArUcoAnalysis = true;
+        arucoJob = cam->submit(VJ_ARUCO);
       }
     }
+    if (sim == NULL and bridge->joy->button[BUTTON_BLUE] and not bluePressed)
+    { // blue button -> dump flight recorder
+      printf("UMission::runMission:: button 2 (blue) pressed -> flight recorder dump\n");
+      blackBox("blue button");
+    }
+    bluePressed = sim == NULL and bridge->joy->button[BUTTON_BLUE];
     // are we finished - event 0 disables motors (e.g. green button)
-    if (bridge->event->isEventSet(0))
+    if (isEventSet(0))
     { // robot say stop
       finished = true;
       printf("Mission:: insist we are finished\n");
+      blackBox("stop");
     }
     else if (mission > toMission)
     { // stop robot
       // make an event 0
-      bridge->send("stop\n");
+      send("stop\n");
       // stop mission loop
       finished = true;
     }
     // release CPU a bit (10ms)
-    usleep(10000);
+    pause(10000);
   }
-  bridge->send("stop\n");
-  snprintf(s, MSL, "espeak \"%s finished.\"  -ven+f4 -s130 -a12  2>/dev/null &", bridge->info->robotname);
-  system(s);
-  printf("Mission:: all finished\n");
-  bridge->send("oled 3 finished\n");
+  send("stop\n");
+  if (sim == NULL)
+  {
+    snprintf(s, MSL, "%s finished.", bridge->info->robotname);
+    notify->say(s, 12);
+    printf("Mission:: all finished\n");
+  }
+  else
+    printf("Mission:: all finished after %.3f s (simulated)\n", sim->simTime);
+  channel->setStatus(3, "finished");
+  // show the last status
+  channel->stop();
 }
 
 ////////////////////////////////////////////////////////////
@@ -338,8 +844,8 @@ bool UMission::mission1(int &state)
     int line = 0;
 
     // clearing both events
-    bridge->event->isEventSet(1);
-    bridge->event->isEventSet(2);
+    clearEvent(1);
+    clearEvent(2);
     // snprintf(lines[line++], MAX_LEN, "vel=0,acc=0, log=5, white=1, edger=0:time=0.5");
     snprintf(lines[line++], MAX_LEN, "vel=0.3, acc=2, white=1, edger=0: dist=1, ir2<0.1");
     snprintf(lines[line++], MAX_LEN, "goto=1:last=8");
@@ -347,72 +853,66 @@ bool UMission::mission1(int &state)
     snprintf(lines[line++], MAX_LEN, "label=1,event=1:time=0.1");
     snprintf(lines[line++], MAX_LEN, "label=2");
     sendAndActivateSnippet(lines, line);
+    // preload both branches while driving, so the decision costs just an event
+    // the bypass is one continuous trajectory: arcs around the corners,
+    // and no stops or correction turns between the segments
+    trajectory.clear();
+    trajectory.vel = 0.2;
+    trajectory.spin(-90);
+    trajectory.straight(-0.2, "ir1<0.3");
+    trajectory.straight(0.2, "ir1>0.5");
+    trajectory.arc(90, 0.2);
+    trajectory.straight(0.2, "ir1<0.25", "event=3");
+    trajectory.straight(0.2, "ir1>0.25");
+    // 0.2m past the obstacle as the baseline (0.1m straight and the arc radius),
+    // tight turn, so that the line sensor is still short of the line
+    trajectory.straight(0.1);
+    trajectory.arc(90, 0.1);
+    trajectory.straight(0.2, "lv>15");
+    trajectory.spin(-90);
+    trajectory.stop("event=1");
+    line = trajectory.make(lines, missionLineMax, MAX_LEN);
+    nextSnippet[0] = preloadSnippet(lines, line);
+    line = 0;
+    snprintf(lines[line++], MAX_LEN, "vel=0,event=1:time=0.1");
+    nextSnippet[1] = preloadSnippet(lines, line);
 
     state = 1;
   }
   break;
 
   case 1:
-    if (bridge->event->isEventSet(2))
+    if (isEventSet(2))
     {
       printf("Object detected, starting avoidance manouver!\n");
-      int line = 0;
-      bridge->event->isEventSet(3);
-      snprintf(lines[line++], MAX_LEN, "vel=0:time=0.1");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=-90");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=5");
-      snprintf(lines[line++], MAX_LEN, "vel=0: time=0.1");
-
-      snprintf(lines[line++], MAX_LEN, "vel=-0.2:ir1<0.3");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:ir1>0.5");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:dist=0.2");
-
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=90");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=-5");
-      snprintf(lines[line++], MAX_LEN, "vel=0, event=3: time=1");
-      sendAndActivateSnippet(lines, line);
+      clearEvent(1);
+      clearEvent(3);
+      activateSnippet(nextSnippet[0]);
+      releasePreloadedSnippets();
 
       state = 2;
     }
 
-    else if (bridge->event->isEventSet(1))
+    else if (isEventSet(1))
     {
       printf("End reached without obstacle!\n");
-      int line = 0;
-      snprintf(lines[line++], MAX_LEN, "vel=0,event=1:time=0.1");
-      sendAndActivateSnippet(lines, line);
+      activateSnippet(nextSnippet[1]);
+      releasePreloadedSnippets();
 
       state = 10;
     }
     break;
 
   case 2:
-    if (bridge->event->isEventSet(3))
-    {
+    if (isEventSet(3))
+    { // the rest of the bypass is in the same snippet
       printf("Avoidance manouver half way!\n");
-      int line = 0;
-      bridge->event->isEventSet(1);
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:ir1<0.25");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:ir1>0.25");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:dist=0.2");
-
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=90");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=-5");
-      snprintf(lines[line++], MAX_LEN, "vel=0: time=1");
-
-      snprintf(lines[line++], MAX_LEN, "vel=0.2:lv>15");
-      snprintf(lines[line++], MAX_LEN, "vel=0: time=1");
-
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=-90");
-      snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=5");
-      snprintf(lines[line++], MAX_LEN, "vel=0,event=1:time=0.1");
-      sendAndActivateSnippet(lines, line);
       state = 10;
     }
     break;
 
   case 10:
-    if (bridge->event->isEventSet(1))
+    if (isEventSet(1))
     {
       printf("\n");
       int line = 0;
@@ -440,7 +940,7 @@ bool UMission::mission2(int &state)
   case 0:
   {
     int line = 0;
-    bridge->event->isEventSet(distanceCount);
+    clearEvent(distanceCount);
 
     snprintf(lines[line++], MAX_LEN, "vel=0, acc=0, log=5, white=1, edgel=0: time=1");
     // snprintf(lines[line++], MAX_LEN, "servo=3, pservo=920: time=1");
@@ -458,50 +958,106 @@ bool UMission::mission2(int &state)
   }
 
   case 1:
-    if (bridge->event->isEventSet(1))
+    if (isEventSet(1))
     {
+      UMapObject ball;
+      float x, y, h;
+      getPose(x, y, h);
+      if (objects->nearest(UObjectMap::OBJ_BALL, -1, x, y, 1.1, mapTime(), ball) and
+          ball.hits >= 3 and objects->confidence(ball, mapTime()) > 0.5)
+      { // ball is remembered from earlier detections - no need to look
+        printf("State 1, ball remembered at (%.2fx, %.2fy)\n", ball.x, ball.y);
+        servoHeading0 = h;
+        approachBall(ball.x, ball.y);
+        state = 40;
+        break;
+      }
+      if (ballScan)
+      { // look for ball while driving the search path
+        int line = 0;
+        clearEvent(3);
+        snprintf(lines[line++], MAX_LEN, "vel=0.0: time=0.3");
+        for (int i = 0; i < 2; i++)
+        { // move 0.3m along line, facing the ball area at both ends
+          snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=90");
+          snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=-5");
+          snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, white=1, edgel=0: dist=0.3");
+          snprintf(lines[line++], MAX_LEN, "vel=0.0, acc=2: time=0.1");
+          snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=-90");
+          snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=5");
+          snprintf(lines[line++], MAX_LEN, "vel=-0.2, acc=2: lv>16");
+          snprintf(lines[line++], MAX_LEN, "vel=0.0: time=0.3");
+        }
+        snprintf(lines[line++], MAX_LEN, "vel=0.0, event=3: time=0.1");
+        sendAndActivateSnippet(lines, line);
+        printf("State 1, ball scan\n");
+        startBallServo();
+        scanHits = 0;
+        state = 60;
+        break;
+      }
+      if (ballServo)
+      { // approach ball while looking
+        printf("State 1, ball servo\n");
+        startBallServo();
+        state = 50;
+        break;
+      }
       int line = 0;
-      bridge->event->isEventSet(2);
+      clearEvent(2);
       snprintf(lines[line++], MAX_LEN, "vel=0.0, event=2: time=5.0");
       sendAndActivateSnippet(lines, line);
 
       printf("State 1\n");
       state = 11;
-      cam->doObjectDetection = true;
+      startBallDetection();
     }
     break;
 
   case 2:
   {
+    if (ballServo)
+    {
+      printf("State 2, ball servo\n");
+      startBallServo();
+      state = 50;
+      break;
+    }
     int line = 0;
-    bridge->event->isEventSet(2);
+    clearEvent(2);
     snprintf(lines[line++], MAX_LEN, "vel=0.0, event=2: time=5.0");
 
     sendAndActivateSnippet(lines, line);
     printf("State 2\n");
     state = 11;
-    cam->doObjectDetection = true;
+    startBallDetection();
   }
   break;
 
   case 3:
   {
+    if (ballServo)
+    {
+      printf("State 3, ball servo\n");
+      startBallServo();
+      state = 50;
+      break;
+    }
     int line = 0;
-    bridge->event->isEventSet(2);
+    clearEvent(2);
     snprintf(lines[line++], MAX_LEN, "vel=0.0, event=2: time=5.0");
 
     sendAndActivateSnippet(lines, line);
     printf("State 3\n");
     state = 11;
-    cam->doObjectDetection = true;
+    startBallDetection();
   }
   break;
 
   case 11:
-    //if ((not cam->doObjectDetection) && bridge->event->isEventSet(2))
-    if ((not cam->doObjectDetection))
+    if (ballDetectionDone())
     {
-      if (cam->distanceToObject > 0.0 and cam->distanceToObject < 1100.0)
+      if (distanceToObject > 0.0 and distanceToObject < 1100.0)
       {
         printf("State 11, object detected!!!\n");
         state = 30;
@@ -523,10 +1079,108 @@ bool UMission::mission2(int &state)
     }
     break;
 
+  case 50:
+  { // visual servo towards ball, until ball is at pickup position
+    float d, a;
+    int obs = newBallObservation(d, a);
+    if (obs == 1)
+    {
+      servoLastSeen = timeNow();
+      // distance to pickup position (negative if the ball is too close)
+      float range = d / 1000 - 0.30;
+      int line = 0;
+      if (range < 0.02 and range > -0.03 and fabs(a) < 3.0)
+      { // at pickup position
+        stopBallServo();
+        float x, y, h;
+        getPose(x, y, h);
+        // heading change since servo start is to be turned back after pickup
+        angle = atan2(sin(h - servoHeading0), cos(h - servoHeading0)) * 180 / M_PI;
+        clearEvent(1);
+        snprintf(lines[line++], MAX_LEN, "vel=0, event=1:time=0.1");
+        sendAndActivateSnippet(lines, line);
+        printf("State 50, at ball (turned %.1f deg)\n", angle);
+        state = 40;
+        break;
+      }
+      // velocity reference, slow down when close
+      float v = fmaxf(0.05, fminf(0.25, 0.8 * range));
+      if (range <= -0.03)
+        // ball is closer than the pickup position (overshoot), back off straight
+        snprintf(lines[line++], MAX_LEN, "vel=-0.1, acc=2: time=%.2f", fminf(0.5, -range / 0.1));
+      else if (fabs(a) > 15.0 or range < 0.02)
+        // turn towards ball on the spot (also when at pickup distance, but not facing the ball)
+        snprintf(lines[line++], MAX_LEN, "vel=0.15, acc=2, tr=0: turn=%.1f", a);
+      else if (fabs(a) < 1.0)
+        snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2: time=0.5, dist=%.3f", v, range);
+      else
+      { // turn radius from wanted turn rate, direction from the sign of the turn condition
+        float w = 1.5 * fabs(a) * M_PI / 180;
+        snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2, tr=%.3f: turn=%.1f, time=0.5, dist=%.3f", v, v / w, a, range);
+      }
+      // stop if no new reference
+      snprintf(lines[line++], MAX_LEN, "vel=0: time=10");
+      sendAndActivateSnippet(lines, line);
+    }
+    else if (timeNow() - servoLastSeen > 1.0)
+    { // ball not seen (or no new frame) for a second
+      stopBallServo();
+      blackBox("ball lost");
+      int line = 0;
+      snprintf(lines[line++], MAX_LEN, "vel=0: time=0.1");
+      sendAndActivateSnippet(lines, line);
+      if (distanceCount <= 2)
+      {
+        state = 20;
+        printf("State 50, no ball in view\n");
+      }
+      else
+      {
+        state = 66;
+        printf("State 50, max distanceCount reached\n");
+        printf("No ball detected\n");
+      }
+    }
+  }
+  break;
+
+  case 60:
+  { // scan - ball detection on every frame while driving the search path
+    float d, a, pose[3];
+    int obs = newBallObservation(d, a, pose);
+    if (obs == 1 and ballSighting(d, a, pose))
+    { // confident sighting - cut search short
+      printf("State 60, ball at (%.2fx, %.2fy) seen %d times\n", scanBallX, scanBallY, scanHits);
+      int line = 0;
+      if (ballServo)
+      { // stop and let the servo take over (servo heading is still the search heading)
+        snprintf(lines[line++], MAX_LEN, "vel=0: time=10");
+        sendAndActivateSnippet(lines, line);
+        servoLastSeen = timeNow();
+        state = 50;
+        break;
+      }
+      // direct approach from current pose
+      stopBallServo();
+      approachBall(scanBallX, scanBallY);
+      state = 40;
+    }
+    else if (isEventSet(3))
+    { // search path finished
+      stopBallServo();
+      blackBox("scan found no ball");
+      distanceCount = 3;
+      state = 66;
+      printf("State 60, scan finished\n");
+      printf("No ball detected\n");
+    }
+  }
+  break;
+
   case 20:
   {
     int line = 0;
-    bridge->event->isEventSet(distanceCount);
+    clearEvent(distanceCount);
 
     snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=90");
     snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=-5");
@@ -543,7 +1197,7 @@ bool UMission::mission2(int &state)
   break;
 
   case 21:
-    if (bridge->event->isEventSet(distanceCount))
+    if (isEventSet(distanceCount))
     {
       distanceCount++;
       state = distanceCount;
@@ -554,9 +1208,9 @@ bool UMission::mission2(int &state)
   case 30:
   {
     int line = 0;
-    bridge->event->isEventSet(1);
-    dist = ((cam->distanceToObject) / 1000 - 0.30);
-    angle = cam->angleToObject;
+    clearEvent(1);
+    dist = (distanceToObject / 1000 - 0.30);
+    angle = angleToObject;
     printf("The distance result is: %f\n", dist);
     printf("The angle result is: %f\n", angle);
 
@@ -571,10 +1225,10 @@ bool UMission::mission2(int &state)
   break;
 
   case 40:
-    if (bridge->event->isEventSet(1))
+    if (isEventSet(1))
     {
       int line = 0;
-      bridge->event->isEventSet(1);
+      clearEvent(1);
 
       snprintf(lines[line++], MAX_LEN, "servo=3,pservo=720:time=0.1");
       snprintf(lines[line++], MAX_LEN, "servo=3,pservo=520:time=0.1");
@@ -593,10 +1247,10 @@ bool UMission::mission2(int &state)
     break;
 
   case 41:
-    if (bridge->event->isEventSet(1))
+    if (isEventSet(1))
     {
       int line = 0;
-      bridge->event->isEventSet(1);
+      clearEvent(1);
       snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0.0: turn=90");
       snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0.0: turn=-5");
       snprintf(lines[line++], MAX_LEN, "vel=0.3, acc=2, white=1, edgel=0: xl>5");
@@ -617,7 +1271,7 @@ bool UMission::mission2(int &state)
   case 66:
   {
     int line = 0;
-    bridge->event->isEventSet(1);
+    clearEvent(1);
     snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=90");
     snprintf(lines[line++], MAX_LEN, "vel=0.2, acc=2, tr=0.0: turn=-5");
     snprintf(lines[line++], MAX_LEN, "vel=0.3, acc=2, white=1, edgel=0: xl>5");
@@ -635,7 +1289,7 @@ bool UMission::mission2(int &state)
   break;
 
   case 99:
-    if (bridge->event->isEventSet(1))
+    if (isEventSet(1))
     {
       printf("State 99: Finishing task\n");
       state = 999;
@@ -660,9 +1314,11 @@ bool UMission::mission3(int &state)
   case 0:
   {
     printf("Go back to junction\n");
+    // world heading, corrected for odometry drift (if landmarks are seen)
+    float head = odoHead(-166);
     int line = 0;
-    snprintf(lines[line++], MAX_LEN, "head=-166,acc=1:time=0.1");
-    snprintf(lines[line++], MAX_LEN, "head=-166,acc=1:time=2");
+    snprintf(lines[line++], MAX_LEN, "head=%.1f,acc=1:time=0.1", head);
+    snprintf(lines[line++], MAX_LEN, "head=%.1f,acc=1:time=2", head);
     snprintf(lines[line++], MAX_LEN, "vel=0,white=1,edgel=0:time=1");
     snprintf(lines[line++], MAX_LEN, "vel=0.15, acc=2:xl>16");
     snprintf(lines[line++], MAX_LEN, "vel=0:time=0.1");
@@ -671,7 +1327,7 @@ bool UMission::mission3(int &state)
     snprintf(lines[line++], MAX_LEN, "vel=0:ir2<0.2");
     snprintf(lines[line++], MAX_LEN, "vel=0,event=10");
     sendAndActivateSnippet(lines, line);
-    bridge->event->isEventSet(10);
+    clearEvent(10);
 
     state = 2;
     break;
@@ -679,7 +1335,7 @@ bool UMission::mission3(int &state)
 
   case 2:
   {
-    if (bridge->event->isEventSet(10))
+    if (isEventSet(10))
     {
       printf("Robot passed, get to the track\n");
 
@@ -693,7 +1349,7 @@ bool UMission::mission3(int &state)
       snprintf(lines[line++], MAX_LEN, "vel=0.2, tr=0, acc=2:turn=-5");
       snprintf(lines[line++], MAX_LEN, "vel=0,event=2");
       sendAndActivateSnippet(lines, line);
-      bridge->event->isEventSet(2);
+      clearEvent(2);
 
       state = 10;
     }
@@ -701,7 +1357,7 @@ bool UMission::mission3(int &state)
   }
 
   case 10:
-    if (bridge->event->isEventSet(2))
+    if (isEventSet(2))
     {
       int line = 0;
       snprintf(lines[line++], MAX_LEN, "vel=0:time=0.1");
@@ -730,23 +1386,40 @@ bool UMission::mission4(int &state)
   case 0:
   {
     printf("Start following other robot\n");
+    if (cam != NULL)
+      // plan speed from the line ahead
+      cam->doLineAhead = true;
+    gapFollow.reset();
     int line = 0;
     snprintf(lines[line++], MAX_LEN, "vel=0,event=3:time=0.5");
     sendAndActivateSnippet(lines, line);
-    bridge->event->isEventSet(3);
+    clearEvent(3);
     state = 4;
   }
   break;
 
   case 4:
-    if (bridge->event->isEventSet(3) || bridge->event->isEventSet(9))
+    if (isEventSet(3) || isEventSet(9))
     {
+      // faster on a straight line, if the camera sees no crossing ahead
+      gapFollow.cruise = lineSpeed(0.4);
+      // and slower to keep the time gap to the lead robot
+      measureLead();
+      float vel = gapFollow.velocity(mapTime());
       int line = 0;
-      snprintf(lines[line++], MAX_LEN, "vel=0.4, acc=2, white=1, edger=0:time=0.1");
-      snprintf(lines[line++], MAX_LEN, "vel=0.4, acc=2, white=1, edger=0:xl>16");
+      // off the crossing first (also when the velocity is changed by followLead())
+      snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2, white=1, edger=0:dist=%.3f", vel, followLeadIn);
+      // followLead() replaces this snippet, when the velocity should change
+      snprintf(lines[line++], MAX_LEN, "vel=%.2f, acc=2, white=1, edger=0:xl>16", vel);
       snprintf(lines[line++], MAX_LEN, "event=4");
       sendAndActivateSnippet(lines, line);
-      bridge->event->isEventSet(4);
+      clearEvent(4);
+      followVel = vel;
+      followSent = mapTime();
+      float h;
+      getPose(followStart[0], followStart[1], h);
+      // stop at once, if too close to the robot in front (should not happen when following)
+      safety->enable(safetyIrFront, true);
 
       state++;
     }
@@ -754,41 +1427,48 @@ bool UMission::mission4(int &state)
 
   case 5:
   {
-    if (bridge->event->isEventSet(4))
+    if (isEventSet(4))
     {
       cross_count += 1;
       printf("Cross counter: %d\n", cross_count);
       if (cross_count == 2)
       {
         printf("Cross counter reached 2, finishing mission.\n");
+        safety->enable(safetyIrFront, false);
         int line = 0;
         snprintf(lines[line++], MAX_LEN, "vel=0,event=5:time=0.1");
         sendAndActivateSnippet(lines, line);
-        bridge->event->isEventSet(5);
+        clearEvent(5);
         state = 6;
         break;
       }
       int line = 0;
       snprintf(lines[line++], MAX_LEN, "event=9");
       sendAndActivateSnippet(lines, line);
-      bridge->event->isEventSet(9);
+      clearEvent(9);
       state = 4;
     }
-    else if (bridge->irdist->dist[1] < 0.2)
-    {
+    else if (safetyStop(safetyIrFront))
+    { // safety monitor has stopped the robot already
       printf("Vehicle too close, waiting...\n");
+      // a new trip would stop the wait snippet too (and event 3 never comes),
+      // state 4 enables the monitor again
+      safety->enable(safetyIrFront, false);
       int line = 0;
-      snprintf(lines[line++], MAX_LEN, "vel=0:time=2");
+      snprintf(lines[line++], MAX_LEN, "vel=0:ir2>0.3, time=2");
       snprintf(lines[line++], MAX_LEN, "event=3");
       sendAndActivateSnippet(lines, line);
-      bridge->event->isEventSet(3);
+      clearEvent(3);
       state = 4;
     }
+    else if (not safety->isPending(safetyIrFront))
+      // keep the time gap to the lead robot (a trip since the test above is handled in the next pass)
+      followLead();
   }
   break;
 
   case 6:
-    if (bridge->event->isEventSet(5))
+    if (isEventSet(5))
     {
       printf("Leaving track.\n");
       int line = 0;
@@ -798,13 +1478,13 @@ bool UMission::mission4(int &state)
       snprintf(lines[line++], MAX_LEN, "vel=0.2,acc=2, white=1, edger=0:lv<4, dist=1");
       snprintf(lines[line++], MAX_LEN, "vel=0,event=10:time=0.1");
       sendAndActivateSnippet(lines, line);
-      bridge->event->isEventSet(10);
+      clearEvent(10);
       state = 10;
     }
     break;
 
   case 10:
-    if (bridge->event->isEventSet(10))
+    if (isEventSet(10))
     {
       int line = 0;
       snprintf(lines[line++], MAX_LEN, "vel=0:time=0.1");
@@ -818,6 +1498,8 @@ bool UMission::mission4(int &state)
   case 999:
   default:
     printf("--> Mission 4 ended\n\n");
+    if (cam != NULL)
+      cam->doLineAhead = false;
     finished = true;
     break;
   }
@@ -848,13 +1530,47 @@ void UMission::openLog()
   }
   else
     printf("#UCamera:: Failed to open image logfile\n");
+  // timing of state transitions
+  snprintf(name, MNL, "log_transition_%s.txt", date);
+  transitions.logTr = fopen(name, "w");
+  if (transitions.logTr != NULL)
+  {
+    const int MSL = 50;
+    char s[MSL];
+    fprintf(transitions.logTr, "%% Mission transition timing log started at %s\n", appTime.getDateTimeAsString(s));
+    transitions.logHeader();
+  }
+  // landmark updates
+  localizer->openLog(date);
+  // record all bridge data updates too
+  if (telemetry == NULL and bridge != NULL)
+    telemetry = new UTelemetry(bridge);
+  if (telemetry != NULL)
+    telemetry->start();
+  // commands and inputs for replay
+  if (traffic == NULL or not traffic->isRecording())
+  {
+    snprintf(name, MNL, "traffic_%s.bin", date);
+    recordTraffic(name);
+  }
 }
 
 void UMission::closeLog()
 {
   if (logMission != NULL)
-  {
+  { // transition summary, the transition log has the details
+    transitions.printStatus(logMission, '%');
     fclose(logMission);
     logMission = NULL;
   }
+  if (transitions.logTr != NULL)
+  {
+    fclose(transitions.logTr);
+    transitions.logTr = NULL;
+  }
+  localizer->closeLog();
+  if (telemetry != NULL)
+    telemetry->stop();
+  if (traffic != NULL)
+    traffic->stop();
 }
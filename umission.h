@@ -29,6 +29,17 @@
 #include "ubridge.h"
 #include "ujoy.h"
 #include "uplay.h"
+#include "unotify.h"
+#include "ucmdchannel.h"
+#include "usafety.h"
+#include "utelemetry.h"
+#include "utraffic.h"
+#include "usubscriptions.h"
+#include "usim.h"
+#include "utransition.h"
+#include "ulocalizer.h"
+#include "ugapfollow.h"
+#include "utrajectory.h"
 
 /**
  * Base class, that makes it easier to starta thread
@@ -47,6 +58,15 @@ public:
   int distanceCount = 1;
   float dist = 0.0;
   float angle = 0.0;
+  /// approach ball in mission 2 using visual servoing (else stop-and-look)
+  bool ballServo = true;
+  /// search for ball in mission 2 while driving (else stop-and-look at each position)
+  bool ballScan = true;
+  /// result of last ball detection (distance in mm and angle in degrees)
+  float distanceToObject = 0.0;
+  float angleToObject = 0.0;
+  /// line following speed on a straight line with no crossing ahead (camera look-ahead)
+  float lineSpeedMax = 0.6;
 
 private:
   /**
@@ -57,8 +77,23 @@ private:
   UCamera *cam;
   /** is thread active */
   bool active = false;
-  // thread on Regbot
-  int threadActive = false;
+  /// number of REGBOT threads in the snippet pool (thread 100, 101, ...)
+  /// each thread holds missionLineMax lines in the REGBOT
+  const static int snippetThreadCnt = 4;
+  /// REGBOT thread number of the first pool thread
+  const static int snippetThreadFirst = 100;
+  /// event that activates the first pool thread, pool thread i uses event snippetEventFirst + i,
+  /// so 4 threads use event 28..31 (event 33 is the REGBOT start event)
+  const static int snippetEventFirst = 28;
+  /// use state of the pool threads
+  enum SnippetState {SNIPPET_FREE, SNIPPET_PRELOADED, SNIPPET_ACTIVE};
+  SnippetState snippetState[snippetThreadCnt];
+  /// time the upload of the pool thread finished
+  UTime snippetLoadTime[snippetThreadCnt];
+  /// pool thread index of the running snippet (-1 if none)
+  int snippetActive = -1;
+  /// REGBOT thread that holds the robot, when started by the safety monitor
+  const static int safetyHoldThread = 99;
   /// space for fabricated lines
   const static int MAX_LINES = 100;
   const static int MAX_LEN = 100;
@@ -69,6 +104,16 @@ private:
   char *lines[missionLineMax];
   /** logfile for mission state */
   FILE *logMission = NULL;
+  /** timing of state transitions, logged to log_transition_[date].txt */
+  UTransitionStats transitions;
+  /** simulated bridge and REGBOT - used instead of bridge, when not NULL */
+  USim *sim = NULL;
+  /** full rate record of bridge data, active while the mission log is open */
+  UTelemetry *telemetry = NULL;
+  /** trace of commands and inputs (for replay), active while the mission log is open */
+  UTraffic *traffic = NULL;
+  /** bridge data streams (and rates) needed by each mission */
+  USubscriptions *subscriptions;
 
 public:
   /**
@@ -80,6 +125,11 @@ public:
   /**
    * Initialize regbot part to accept mission commands */
   void missionInit();
+  /**
+   * Wait for heartbeat from the bridge (polled)
+   * \param timeout is the max wait [sec]
+   * \returns true if bridge (or simulator) is OK */
+  bool waitForBridge(float timeout);
   void openLog();
   void closeLog();
   inline bool logIsOpen() { return logMission != NULL; };
@@ -112,6 +162,36 @@ public:
   /**
    * Print status for mission */
   void printStatus();
+  /**
+   * Run the missions against a simulated robot (bridge and camera are not used).
+   * Must be set before start(). */
+  void setSimulator(USim *simulator)
+  {
+    sim = simulator;
+    notify->mute = sim != NULL;
+    channel->setSim(sim);
+    safety->setSim(sim);
+  }
+  /**
+   * Record the bridge traffic to this file (for replay),
+   * started by openLog() too. Must be set after setSimulator(). */
+  void recordTraffic(const char *filename);
+
+  /**
+   * Time of the startup phases [sec] */
+  struct Startup
+  {
+    double begin = 0, uploaded = 0, heartbeat = 0, ready = -1;
+    void print()
+    {
+      if (ready < 0)
+        printf("# startup: not ready (upload %.3f s, heartbeat wait %.3f s)\n",
+               uploaded - begin, heartbeat - uploaded);
+      else
+        printf("# startup: ready after %.3f s (upload %.3f s, heartbeat wait %.3f s, REGBOT start %.3f s)\n",
+               ready - begin, uploaded - begin, heartbeat - uploaded, ready - heartbeat);
+    }
+  } startup;
 
   /** which missions to run 
    * These values can be set as parameters, when starting the mission */
@@ -135,15 +215,167 @@ private:
   /**
    * Send a number of lines to the REGBOT in a dormant thread, and 
    * make these lines (mission snippet) active - stopping the last set of lines.
+   * If no pool thread is free, the preloaded snippets are released to make room.
    * \param missionLines is a pointer to an array of c-strings
    * \param missionLineCnt is the number of strings to be send from the missionLine array. */
   void sendAndActivateSnippet(char *missionLines[], int missionLineCnt);
+  /**
+   * Send a number of lines to a dormant pool thread in the REGBOT, but do not start it.
+   * The snippet can then later be started with activateSnippet(), costing just one event.
+   * Use this to upload the likely next snippets while the current snippet is running.
+   * \param missionLines is a pointer to an array of c-strings
+   * \param missionLineCnt is the number of strings to be send from the missionLine array.
+   * A preloaded snippet is never replaced, so when all threads are preloaded
+   * (or running) nothing is loaded, release the preloaded snippets first.
+   * \returns the pool index of the loaded thread, or -1 if there is no free thread */
+  int preloadSnippet(char *missionLines[], int missionLineCnt);
+  /**
+   * Start a preloaded snippet - stopping the running snippet.
+   * \param snippet is the pool index returned by preloadSnippet(). */
+  void activateSnippet(int snippet);
+  /**
+   * Forget all preloaded (not started) snippets, e.g. the branch not taken,
+   * so that their threads can be reused. */
+  void releasePreloadedSnippets();
+  /**
+   * Get (and clear) event from REGBOT (or simulator), the event is saved in the traffic log and telemetry */
+  bool takeEvent(int event);
+  /**
+   * Send a command to the bridge (or simulator) - high priority */
+  void send(const char *cmd);
+  /**
+   * Send path to bridge, with low priority O-led status */
+  UCmdChannel *channel;
+  /**
+   * Test (and clear) an awaited event from REGBOT (or simulator).
+   * If set, the event starts the decide phase of the next transition */
+  bool isEventSet(int event);
+  /**
+   * Clear a (possibly stale) event without using it */
+  void clearEvent(int event);
+  /**
+   * IR distance in meter, sensor 0 is ir1, 1 is ir2 */
+  float irDist(int sensor);
+  /**
+   * Wait a number of microseconds (simulated time, if simulated) */
+  void pause(int us);
+  /**
+   * Save the pose, IR and velocity inputs to the traffic trace (if changed) */
+  void recordInputs();
+  /**
+   * Time now in seconds (monotonic, or simulated time) */
+  double timeNow();
+  /**
+   * Robot pose (x,y in meter, h in radians) */
+  void getPose(float &x, float &y, float &h);
+  /**
+   * Request a ball detection from the camera (or simulator) */
+  void startBallDetection();
+  /**
+   * Test if ball detection is finished, result is then in distanceToObject and angleToObject
+   * \returns true if finished */
+  bool ballDetectionDone();
+  /// pending vision jobs (ball detection, and from gamepad buttons)
+  UVisionJobPtr ballJob, saveJob, arucoJob;
+  /**
+   * Start and stop ball detection on every frame (visual servoing) */
+  void startBallServo();
+  void stopBallServo();
+  /**
+   * Get ball observation from a new frame in servo mode
+   * \param distance is distance to ball in mm, angle is in degrees
+   * \param pose if not NULL, then robot pose (x, y, h) at image time is returned here
+   * \returns -1 if no new frame, 0 if ball is not found, 1 if found */
+  int newBallObservation(float &distance, float &angle, float *pose = NULL);
+  /**
+   * Test a ball observation (taken at this robot pose) against the object map
+   * \returns true when the ball is seen (at the same world position) 3 times */
+  bool ballSighting(float distance, float angle, float *pose);
+  /// scan: ball position in world coordinates and number of consistent sightings
+  float scanBallX = 0, scanBallY = 0;
+  int scanHits = 0;
+  /**
+   * Turn towards and drive to pickup distance of a ball at this world position,
+   * sets angle to heading change relative to servoHeading0 (event 1 when there) */
+  void approachBall(float bx, float by);
+  /**
+   * Detected objects in world coordinates (from camera, or own map if simulated) */
+  UObjectMap *objects;
+  bool ownObjects = false;
+  /**
+   * Time used in object map (image time of camera, or simulated time) */
+  double mapTime();
+  /**
+   * Flight recorder (from camera), NULL when simulated */
+  UFlightRecorder *recorder = NULL;
+  /**
+   * Dump flight recorder history (if there is a recorder)
+   * \param reason is saved with the dump */
+  void blackBox(const char *reason);
+  /**
+   * Pose correction from ArUco landmarks (landmark map in markers.txt) */
+  ULocalizer *localizer;
+  /// markers from camera used by localizer (last frame used)
+  vector<UArUcoMarker> locMarkers;
+  int locFrame = -1;
+  /**
+   * Odometry and new markers to the localizer (called every mission loop) */
+  void localize(const float *pose);
+  /**
+   * Adaptive cruise behind the lead robot (mission 4) */
+  UGapFollow gapFollow;
+  /// velocity in the running follow snippet, and time it was sent (mapTime())
+  float followVel = 0;
+  double followSent = 0;
+  /// position at start of a leg (on a crossing), and distance to get off the crossing [m]
+  float followStart[2] = {0, 0};
+  float followLeadIn = 0.1;
+  /**
+   * Gap measurement (front IR) to the lead robot filter */
+  void measureLead();
+  /**
+   * Update gap to lead robot, and change velocity of the follow snippet if needed */
+  void followLead();
+  /**
+   * Continuous manoeuvres (e.g. the obstacle bypass in mission 1) */
+  UTrajectory trajectory;
+  /**
+   * Own velocity (mean of wheels) [m/s] */
+  float ownVel();
+  /**
+   * Line following speed from the camera line look-ahead
+   * \param vel is speed used if there is no (recent) look-ahead, and for curves and crossings
+   * \returns speed [m/s] */
+  float lineSpeed(float vel);
+  /**
+   * Odometry heading (degrees) for a world heading (degrees), to be used in 'head=' lines */
+  float odoHead(float worldDeg);
+  /// servo state: heading at start, time ball was last seen and last frame used
+  float servoHeading0 = 0;
+  double servoLastSeen = 0;
+  int servoLastFrame = -1;
+  /**
+   * Test if a safety predicate has tripped, the robot is then
+   * held by the REGBOT hold thread and the running snippet is stopped.
+   * \returns true if tripped (once for each trip) */
+  bool safetyStop(int predicate);
+  /**
+   * Reactive safety monitor (IR distance etc.) */
+  USafety *safety;
+  /// predicate for obstacle close in front (ir2)
+  int safetyIrFront;
   /**
    * Object to play a soundfile as we go */
   UPlay play;
+  /**
+   * Speech and sound worker (uses play), so that the mission thread never waits for audio */
+  UNotify *notify;
   /**
    * turn count, when looking for feature */
   int featureCnt;
+  /**
+   * pool index of preloaded snippets for the next branch of a mission */
+  int nextSnippet[2] = {-1, -1};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <pthread.h>
+#include "unotify.h"
+
+UNotify::UNotify(UPlay *player)
+{
+  play = player;
+  th1 = NULL;
+  th1stop = false;
+  th1 = new thread(runObj, this);
+}
+
+UNotify::~UNotify()
+{
+  stop();
+}
+
+void UNotify::stop()
+{
+  {
+    lock_guard<mutex> guard(qLock);
+    th1stop = true;
+  }
+  qWait.notify_one();
+  if (th1 != NULL)
+  { // worker says the queued messages (e.g. 'finished') before it ends
+    th1->join();
+    delete th1;
+    th1 = NULL;
+  }
+  for (int i = 0; i < MAX_VOICES; i++)
+  {
+    if (voicePipe[i] != NULL)
+    {
+      pclose(voicePipe[i]);
+      voicePipe[i] = NULL;
+    }
+  }
+}
+
+bool UNotify::add(bool isFile, const char *text, int amplitude)
+{
+  if (mute)
+    return true;
+  {
+    lock_guard<mutex> guard(qLock);
+    if (qCnt >= MAX_MSG)
+    {
+      dropCnt++;
+      return false;
+    }
+    Msg &m = queue[(qHead + qCnt) % MAX_MSG];
+    m.isFile = isFile;
+    m.amplitude = amplitude;
+    strncpy(m.text, text, MAX_LEN - 1);
+    m.text[MAX_LEN - 1] = '\0';
+    qCnt++;
+  }
+  qWait.notify_one();
+  return true;
+}
+
+bool UNotify::say(const char *text, int amplitude)
+{
+  return add(false, text, amplitude);
+}
+
+bool UNotify::playFile(const char *filename)
+{
+  return add(true, filename, 0);
+}
+
+void UNotify::closeVoice(FILE *f)
+{
+  for (int i = 0; i < MAX_VOICES; i++)
+  {
+    if (voicePipe[i] == f)
+    { // keep the remaining voices in the first slots
+      pclose(f);
+      for (int j = i + 1; j < MAX_VOICES; j++)
+      {
+        voicePipe[j - 1] = voicePipe[j];
+        voiceAmp[j - 1] = voiceAmp[j];
+      }
+      voicePipe[MAX_VOICES - 1] = NULL;
+      break;
+    }
+  }
+}
+
+FILE *UNotify::voice(int amplitude)
+{
+  int i;
+  for (i = 0; i < MAX_VOICES; i++)
+  {
+    if (voicePipe[i] != NULL and voiceAmp[i] == amplitude)
+      return voicePipe[i];
+    if (voicePipe[i] == NULL)
+      break;
+  }
+  if (i == MAX_VOICES)
+  { // all used, reuse the last
+    i = MAX_VOICES - 1;
+    pclose(voicePipe[i]);
+  }
+  // espeak reads and says a line at a time from stdin
+  const int MSL = 100;
+  char s[MSL];
+  snprintf(s, MSL, "espeak -ven+f4 -s130 -a%d 2>/dev/null", amplitude);
+  voicePipe[i] = popen(s, "w");
+  voiceAmp[i] = amplitude;
+  return voicePipe[i];
+}
+
+void UNotify::run()
+{
+  Msg m;
+  // a dead espeak process should not kill us when writing to the pipe,
+  // SIGPIPE is blocked in this (the only writing) thread, and the write fails with EPIPE
+  sigset_t pipeSet;
+  sigemptyset(&pipeSet);
+  sigaddset(&pipeSet, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipeSet, NULL);
+  while (true)
+  {
+    {
+      unique_lock<mutex> guard(qLock);
+      qWait.wait(guard, [this] { return qCnt > 0 or th1stop; });
+      if (qCnt == 0)
+        // stopped, and all is said
+        break;
+      m = queue[qHead];
+      qHead = (qHead + 1) % MAX_MSG;
+      qCnt--;
+    }
+    if (m.isFile)
+    {
+      play->setFile(m.text);
+      play->start();
+    }
+    else
+    {
+      FILE *f = voice(m.amplitude);
+      if (f != NULL)
+      {
+        fprintf(f, "%s\n", m.text);
+        if (fflush(f) == 0)
+          sayCnt++;
+        else if (errno == EPIPE)
+        { // espeak has died, remove the pending SIGPIPE, and start a new one next time
+          timespec noWait = {0, 0};
+          sigtimedwait(&pipeSet, NULL, &noWait);
+          closeVoice(f);
+          failCnt++;
+        }
+      }
+    }
+  }
+}
+
+void UNotify::printStatus()
+{
+  lock_guard<mutex> guard(qLock);
+  printf("# notify: said %d, queued %d, dropped %d, failed %d, mute=%d\n", sayCnt, qCnt, dropCnt, failCnt, mute);
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UNOTIFY_H
+#define UNOTIFY_H
+
+#include <cstdio>
+#include <mutex>
+#include <condition_variable>
+#include "urun.h"
+#include "uplay.h"
+
+/**
+ * Audio notification worker.
+ * Speech and sound files are queued by the mission thread, and
+ * played by this thread, so the mission thread never waits for
+ * a (forked) process.
+ * Speech uses long-lived espeak processes (one for each volume),
+ * that read the text from a pipe; sound files are played by the UPlay object. */
+class UNotify : public URun
+{
+public:
+  /// max queued messages, further messages are dropped
+  const static int MAX_MSG = 8;
+  const static int MAX_LEN = 100;
+  /// max number of different speech volumes (one espeak process each)
+  const static int MAX_VOICES = 4;
+  /// no sound at all (e.g. in simulation)
+  bool mute = false;
+
+public:
+  /**
+   * Constructor - starts worker thread
+   * \param player is the sound file player */
+  UNotify(UPlay *player);
+  /** destructor - stops thread and speech processes */
+  ~UNotify();
+  /**
+   * Queue text to be spoken, never waits.
+   * \param text is the text to say
+   * \param amplitude is the espeak amplitude (0..200, default 100)
+   * \returns false if the queue is full */
+  bool say(const char *text, int amplitude = 100);
+  /**
+   * Queue a sound file to be played by UPlay
+   * \returns false if the queue is full */
+  bool playFile(const char *filename);
+  /** stop worker thread, after the queued messages are said */
+  void stop();
+  /** print status */
+  void printStatus();
+  /** worker thread */
+  void run();
+
+private:
+  struct Msg
+  {
+    bool isFile;
+    int amplitude;
+    char text[MAX_LEN];
+  };
+  bool add(bool isFile, const char *text, int amplitude);
+  /** get (or start) the espeak process for this volume */
+  FILE *voice(int amplitude);
+  /** end a (dead) espeak process */
+  void closeVoice(FILE *f);
+  //
+  UPlay *play;
+  Msg queue[MAX_MSG];
+  int qHead = 0, qCnt = 0;
+  mutex qLock;
+  condition_variable qWait;
+  /// speech processes
+  FILE *voicePipe[MAX_VOICES] = {NULL};
+  int voiceAmp[MAX_VOICES] = {0};
+  /// statistics
+  int sayCnt = 0, dropCnt = 0, failCnt = 0;
+};
+
+#endif
@@ -0,0 +1,247 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cmath>
+#include <opencv2/imgproc/imgproc.hpp>
+#include "uobjectdetect.h"
+
+/// lookup table quantization: H 0..179 (1 step), S and V 0..255 (8 steps)
+#define LUT_S 32
+#define LUT_V 32
+
+UObjectDetector::UObjectDetector()
+{
+  // red hue wraps around 0
+  int red = addColour("red", cv::Scalar(160, 100, 77), cv::Scalar(10, 255, 255));
+  int blue = addColour("blue", cv::Scalar(100, 120, 50), cv::Scalar(130, 255, 255));
+  addModel("red ball", red, 0.042, SHAPE_BALL);
+  addModel("blue ball", blue, 0.042, SHAPE_BALL);
+}
+
+int UObjectDetector::addColour(const char *name, cv::Scalar lo, cv::Scalar hi)
+{
+  lock_guard<mutex> guard(lock);
+  if (colours.size() >= 255)
+  {
+    printf("# UObjectDetector::addColour: no space for '%s'\n", name);
+    return -1;
+  }
+  colours.push_back({name, lo, hi});
+  lutValid = false;
+  return colours.size() - 1;
+}
+
+int UObjectDetector::addModel(const char *name, int colour, float size, Shape shape, float minScore)
+{
+  lock_guard<mutex> guard(lock);
+  if (colour < 0 or colour >= (int)colours.size())
+  {
+    printf("# UObjectDetector::addModel: no colour %d for '%s'\n", colour, name);
+    return -1;
+  }
+  models.push_back({name, colour, size, shape, minScore});
+  return models.size() - 1;
+}
+
+const char *UObjectDetector::modelName(int model)
+{
+  if (model < 0 or model >= (int)models.size())
+    return "unknown";
+  return models[model].name.c_str();
+}
+
+void UObjectDetector::makeLut()
+{
+  lut.assign(180 * LUT_S * LUT_V, 0);
+  for (int h = 0; h < 180; h++)
+    for (int s = 0; s < LUT_S; s++)
+      for (int v = 0; v < LUT_V; v++)
+      { // first matching colour (middle of the quantization step)
+        float sv = s * 256 / LUT_S + 128 / LUT_S;
+        float vv = v * 256 / LUT_V + 128 / LUT_V;
+        for (size_t c = 0; c < colours.size(); c++)
+        {
+          const Colour &col = colours[c];
+          bool hueOK;
+          if (col.lo[0] <= col.hi[0])
+            hueOK = h >= col.lo[0] and h <= col.hi[0];
+          else
+            hueOK = h >= col.lo[0] or h <= col.hi[0];
+          if (hueOK and sv >= col.lo[1] and sv <= col.hi[1] and vv >= col.lo[2] and vv <= col.hi[2])
+          {
+            lut[(h * LUT_S + s) * LUT_V + v] = c + 1;
+            break;
+          }
+        }
+      }
+  lutValid = true;
+}
+
+int UObjectDetector::root(int i)
+{
+  while (parent[i] != i)
+  { // path halving
+    parent[i] = parent[parent[i]];
+    i = parent[i];
+  }
+  return i;
+}
+
+int UObjectDetector::detect(cv::Mat im, float imScale, const cv::Mat &cameraMatrix, const cv::Mat &cam2robot, vector<UDetection> &result)
+{
+  lock_guard<mutex> guard(lock);
+  result.clear();
+  if (not lutValid)
+    makeLut();
+  frameCnt++;
+  // reduce (if not reduced already) and convert (work images are reused)
+  float s = scale / imScale;
+  if (fabs(s - 1) < 0.01)
+    cv::cvtColor(im, hsv, cv::COLOR_BGR2HSV);
+  else
+  {
+    cv::resize(im, small, cv::Size(), s, s, cv::INTER_AREA);
+    cv::cvtColor(small, hsv, cv::COLOR_BGR2HSV);
+  }
+  const int w = hsv.cols, h = hsv.rows;
+  const int n = w * h;
+  // classify and connect in one pass (union-find, same class only)
+  // unclassified pixels (class 0) are left as their own root
+  parent.resize(n);
+  cls.resize(n);
+  for (int r = 0; r < h; r++)
+  {
+    const cv::Vec3b *row = hsv.ptr<cv::Vec3b>(r);
+    for (int c = 0; c < w; c++)
+    {
+      int i = r * w + c;
+      const cv::Vec3b &p = row[c];
+      unsigned char k = lut[(p[0] * LUT_S + p[1] * LUT_S / 256) * LUT_V + p[2] * LUT_V / 256];
+      cls[i] = k;
+      parent[i] = i;
+      if (k == 0)
+        continue;
+      if (c > 0 and cls[i - 1] == k)
+        parent[i] = root(i - 1);
+      if (r > 0 and cls[i - w] == k)
+      {
+        int a = root(i - w);
+        int b = root(i);
+        if (a != b)
+          parent[max(a, b)] = min(a, b);
+      }
+    }
+  }
+  // blob statistics
+  struct Blob
+  {
+    int cls, area = 0;
+    int x0, y0, x1, y1;
+    double sx = 0, sy = 0;
+  };
+  vector<Blob> blobs;
+  blobIdx.assign(n, -1);
+  for (int i = 0; i < n; i++)
+  {
+    if (cls[i] == 0)
+      continue;
+    int rt = root(i);
+    int b = blobIdx[rt];
+    int x = i % w, y = i / w;
+    if (b < 0)
+    {
+      b = blobIdx[rt] = blobs.size();
+      Blob nb;
+      nb.cls = cls[i] - 1;
+      nb.x0 = nb.x1 = x;
+      nb.y0 = nb.y1 = y;
+      blobs.push_back(nb);
+    }
+    Blob &bl = blobs[b];
+    bl.area++;
+    bl.sx += x;
+    bl.sy += y;
+    bl.x0 = min(bl.x0, x);
+    bl.x1 = max(bl.x1, x);
+    bl.y0 = min(bl.y0, y);
+    bl.y1 = max(bl.y1, y);
+  }
+  // test blobs against models
+  const float f = cameraMatrix.at<double>(0, 0);
+  const float cx0 = cameraMatrix.at<double>(0, 2);
+  const float cy0 = cameraMatrix.at<double>(1, 2);
+  for (auto &bl : blobs)
+  {
+    if (bl.area < minArea)
+      continue;
+    int bw = bl.x1 - bl.x0 + 1, bh = bl.y1 - bl.y0 + 1;
+    for (size_t m = 0; m < models.size(); m++)
+    {
+      const Model &md = models[m];
+      if (md.colour != bl.cls)
+        continue;
+      float score, sizePix;
+      if (md.shape == SHAPE_BALL)
+      { // a disc fills pi/4 of its bounding box, and is round
+        float fill = bl.area / (M_PI / 4 * bw * bh);
+        score = fminf(fill, 1 / fill) * fminf(bw, bh) / fmaxf(bw, bh);
+        sizePix = (bw + bh) / 2.0 / scale;
+      }
+      else
+      {
+        score = float(bl.area) / (bw * bh);
+        sizePix = sqrt(bl.area) / scale;
+      }
+      if (score < md.minScore)
+        continue;
+      UDetection d;
+      d.model = m;
+      d.score = score;
+      d.area = bl.area / (scale * scale);
+      d.box = cv::Rect(bl.x0 / scale, bl.y0 / scale, bw / scale, bh / scale);
+      // position in camera coordinates (x=right, y=down, z=fwd) from apparent size
+      float zc = f * md.size / sizePix;
+      float xc = (bl.sx / bl.area / scale - cx0) / f * zc;
+      float yc = (bl.sy / bl.area / scale - cy0) / f * zc;
+      cv::Mat pc = (cv::Mat_<float>(4, 1) << xc, yc, zc, 1);
+      cv::Mat pr = cam2robot * pc;
+      d.x = pr.at<float>(0, 0);
+      d.y = pr.at<float>(1, 0);
+      d.z = pr.at<float>(2, 0);
+      d.distance = hypot(d.x, d.y);
+      d.angle = atan2(d.y, d.x) * 180 / M_PI;
+      result.push_back(d);
+    }
+  }
+  detectCnt += result.size();
+  return result.size();
+}
+
+void UObjectDetector::printStatus()
+{
+  lock_guard<mutex> guard(lock);
+  printf("# object detector: %d colours, %d models, %d detections in %d frames (scale %g)\n",
+         (int)colours.size(), (int)models.size(), detectCnt, frameCnt, scale);
+  for (size_t m = 0; m < models.size(); m++)
+    printf("#   model %d '%s': colour '%s', size %.3fm, %s, min score %.2f\n",
+           (int)m, models[m].name.c_str(), colours[models[m].colour].name.c_str(), models[m].size,
+           models[m].shape == SHAPE_BALL ? "ball" : "blob", models[m].minScore);
+}
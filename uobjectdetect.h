@@ -0,0 +1,130 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UOBJECTDETECT_H
+#define UOBJECTDETECT_H
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include <opencv2/core/core.hpp>
+
+using namespace std;
+
+/**
+ * An object found in an image */
+struct UDetection
+{
+  /// object model index (see UObjectDetector::modelName())
+  int model = 0;
+  /// how well the object fits the model shape (0..1)
+  float score = 0;
+  /// object centre in robot coordinates (x=fwd, y=left, z=up) [m]
+  float x = 0, y = 0, z = 0;
+  /// distance from robot centre [m] and angle [degrees, positive is left]
+  float distance = 0, angle = 0;
+  /// pixel area and bounding box (full image resolution)
+  int area = 0;
+  cv::Rect box;
+};
+
+/**
+ * Object detection for a registry of object models.
+ * A model is a colour class, a physical size and a shape.
+ * All models are detected in one pass: each pixel is classified to one colour
+ * class (through a lookup table), then one connected-components pass (only
+ * pixels of the same class are connected) finds the blobs, that are tested
+ * against the models of that colour. */
+class UObjectDetector
+{
+public:
+  enum Shape {SHAPE_BALL, SHAPE_BLOB};
+  /// image is reduced by this factor before classification
+  float scale = 0.5;
+  /// smallest blob (in pixels at reduced resolution)
+  int minArea = 30;
+
+public:
+  /** Constructor - with red and blue ball models */
+  UObjectDetector();
+  /**
+   * Add a colour class
+   * \param name is colour name
+   * \param lo, hi is HSV range (OpenCV scale, H is 0..180), if lo H > hi H, then hue wraps around 0
+   * \returns colour index */
+  int addColour(const char *name, cv::Scalar lo, cv::Scalar hi);
+  /**
+   * Add an object model
+   * \param name is object name
+   * \param colour is colour index
+   * \param size is diameter (ball) or side length (blob) [m]
+   * \param shape is the expected shape
+   * \param minScore is the minimum shape score for a detection
+   * \returns model index */
+  int addModel(const char *name, int colour, float size, Shape shape, float minScore = 0.5);
+  /**
+   * Find all objects in an image
+   * \param im is the BGR image
+   * \param imScale is the size of im relative to full resolution (e.g. a pyramid level)
+   * \param cameraMatrix is the camera matrix (for full resolution)
+   * \param cam2robot is the 4x4 camera to robot coordinate transformation
+   * \param result is the list of detections (cleared first)
+   * \returns number of detections */
+  int detect(cv::Mat im, float imScale, const cv::Mat &cameraMatrix, const cv::Mat &cam2robot, vector<UDetection> &result);
+  /** name of model */
+  const char *modelName(int model);
+  /** print registry */
+  void printStatus();
+
+private:
+  struct Colour
+  {
+    string name;
+    cv::Scalar lo, hi;
+  };
+  struct Model
+  {
+    string name;
+    int colour;
+    float size;
+    Shape shape;
+    float minScore;
+  };
+  /** make HSV to colour class lookup table */
+  void makeLut();
+  /** root of union-find tree */
+  int root(int i);
+  //
+  mutex lock;
+  vector<Colour> colours;
+  vector<Model> models;
+  /// colour class (index + 1) for quantized HSV (H 180, S 32, V 32), 0 is none
+  vector<unsigned char> lut;
+  bool lutValid = false;
+  /// work space reused between frames
+  cv::Mat small, hsv;
+  vector<int> parent, blobIdx;
+  vector<unsigned char> cls;
+  /// statistics
+  int frameCnt = 0;
+  int detectCnt = 0;
+};
+
+#endif
@@ -0,0 +1,166 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cmath>
+#include "uobjectmap.h"
+
+long long UObjectMap::cellKey(float x, float y)
+{
+  return cellKey(int(floor(x / cellSize)), int(floor(y / cellSize)));
+}
+
+float UObjectMap::confidence(const UMapObject &obj, double t)
+{
+  double dt = t - obj.lastSeen;
+  if (dt <= 0)
+    return obj.confidence;
+  return obj.confidence * pow(0.5, dt / decayTime);
+}
+
+UMapObject UObjectMap::add(int type, int id, float fwd, float left, const float *pose, double t)
+{
+  lock_guard<mutex> guard(lock);
+  // to world coordinates
+  float co = cos(pose[2]), si = sin(pose[2]);
+  float x = pose[0] + fwd * co - left * si;
+  float y = pose[1] + fwd * si + left * co;
+  // find object to fuse with (in this and neighbour cells)
+  int cx = int(floor(x / cellSize)), cy = int(floor(y / cellSize));
+  int best = -1;
+  float bestDist = fuseDist;
+  for (int i = cx - 1; i <= cx + 1; i++)
+    for (int j = cy - 1; j <= cy + 1; j++)
+    {
+      auto cell = grid.find(cellKey(i, j));
+      if (cell == grid.end())
+        continue;
+      for (int n : cell->second)
+      {
+        UMapObject &ob = objects[n];
+        float d = hypot(ob.x - x, ob.y - y);
+        if (ob.type == type and ob.id == id and d < bestDist)
+        {
+          best = n;
+          bestDist = d;
+        }
+      }
+    }
+  addCnt++;
+  if (best < 0)
+  { // new object
+    UMapObject ob;
+    ob.type = type;
+    ob.id = id;
+    ob.x = x;
+    ob.y = y;
+    ob.hits = 1;
+    ob.confidence = 0.5;
+    ob.firstSeen = t;
+    ob.lastSeen = t;
+    objects.push_back(ob);
+    grid[cellKey(x, y)].push_back(objects.size() - 1);
+    // old objects are removed now and then
+    if (addCnt % 100 == 0)
+      prune(t);
+    return ob;
+  }
+  UMapObject &ob = objects[best];
+  long long key = cellKey(ob.x, ob.y);
+  // running average of position (max weight 10, so that it can follow a moved object)
+  float w = fminf(ob.hits, 10);
+  ob.x = (ob.x * w + x) / (w + 1);
+  ob.y = (ob.y * w + y) / (w + 1);
+  ob.hits++;
+  float c = confidence(ob, t);
+  ob.confidence = c + (1 - c) * 0.5;
+  ob.lastSeen = t;
+  if (cellKey(ob.x, ob.y) != key)
+  { // moved to another cell
+    vector<int> &cell = grid[key];
+    for (size_t i = 0; i < cell.size(); i++)
+      if (cell[i] == best)
+      {
+        cell.erase(cell.begin() + i);
+        break;
+      }
+    grid[cellKey(ob.x, ob.y)].push_back(best);
+  }
+  return ob;
+}
+
+bool UObjectMap::nearest(int type, int id, float x, float y, float maxDist, double t, UMapObject &obj)
+{
+  lock_guard<mutex> guard(lock);
+  int cx = int(floor(x / cellSize)), cy = int(floor(y / cellSize));
+  int r = int(ceil(maxDist / cellSize));
+  bool found = false;
+  float bestDist = maxDist;
+  for (int i = cx - r; i <= cx + r; i++)
+    for (int j = cy - r; j <= cy + r; j++)
+    {
+      auto cell = grid.find(cellKey(i, j));
+      if (cell == grid.end())
+        continue;
+      for (int n : cell->second)
+      {
+        UMapObject &ob = objects[n];
+        if (ob.type != type or (id >= 0 and ob.id != id))
+          continue;
+        float d = hypot(ob.x - x, ob.y - y);
+        if (d <= bestDist and confidence(ob, t) >= minConfidence)
+        {
+          obj = ob;
+          bestDist = d;
+          found = true;
+        }
+      }
+    }
+  return found;
+}
+
+void UObjectMap::prune(double t)
+{
+  vector<UMapObject> keep;
+  for (auto &ob : objects)
+    if (confidence(ob, t) >= minConfidence)
+      keep.push_back(ob);
+  objects.swap(keep);
+  grid.clear();
+  for (size_t i = 0; i < objects.size(); i++)
+    grid[cellKey(objects[i].x, objects[i].y)].push_back(i);
+}
+
+void UObjectMap::clear()
+{
+  lock_guard<mutex> guard(lock);
+  objects.clear();
+  grid.clear();
+}
+
+void UObjectMap::printStatus(double t)
+{
+  lock_guard<mutex> guard(lock);
+  printf("# object map: %d objects from %d detections (fused within %.2fm)\n",
+         (int)objects.size(), addCnt, fuseDist);
+  for (auto &ob : objects)
+    printf("#   type %d id %d at (%.2fx, %.2fy), %d hits, confidence %.2f, last seen %.1fs ago\n",
+           ob.type, ob.id, ob.x, ob.y, ob.hits, confidence(ob, t), t - ob.lastSeen);
+}
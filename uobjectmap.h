@@ -0,0 +1,112 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UOBJECTMAP_H
+#define UOBJECTMAP_H
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ * An object in the world map */
+struct UMapObject
+{
+  /// object type (ball, ArUco marker)
+  int type = 0;
+  /// marker ID or colour class (objects of same type and id are fused)
+  int id = 0;
+  /// position in world (odometry) coordinates [m]
+  float x = 0, y = 0;
+  /// number of detections fused into this object
+  int hits = 0;
+  /// confidence (0..1) at lastSeen
+  float confidence = 0;
+  /// time of first and latest detection [sec]
+  double firstSeen = 0, lastSeen = 0;
+};
+
+/**
+ * Map of detected objects in world coordinates.
+ * Detections (robot relative, with the robot pose at image time) are fused
+ * with a nearby object of the same type and id, or make a new object.
+ * Confidence grows with each detection and decays with time since the
+ * object was last seen, objects with too low confidence are removed.
+ * A grid index makes updates and nearest-object queries cheap.
+ * Detections are added by the camera thread, and queried by the mission. */
+class UObjectMap
+{
+public:
+  /// OBJ_MODEL is objects from UObjectDetector, the id is the model index
+  enum ObjectType {OBJ_BALL, OBJ_ARUCO, OBJ_MODEL};
+  /// detections closer than this are the same object [m]
+  float fuseDist = 0.15;
+  /// confidence half-time for objects not seen [sec]
+  float decayTime = 30;
+  /// objects below this confidence are removed
+  float minConfidence = 0.05;
+
+public:
+  /**
+   * Add a detection
+   * \param type, id is the object class
+   * \param fwd, left is the object position relative to robot [m]
+   * \param pose is robot pose (x, y, h) at image time
+   * \param t is image time [sec]
+   * \returns the updated (or new) object */
+  UMapObject add(int type, int id, float fwd, float left, const float *pose, double t);
+  /**
+   * Find the nearest object of this type
+   * \param type is object type, id is object id or -1 for any id
+   * \param x,y is the position to search from (world coordinates)
+   * \param maxDist is the search radius [m]
+   * \param t is time now (for confidence)
+   * \param obj is set to the found object
+   * \returns true if found */
+  bool nearest(int type, int id, float x, float y, float maxDist, double t, UMapObject &obj);
+  /** current confidence of an object (decayed to time t) */
+  float confidence(const UMapObject &obj, double t);
+  /** remove all objects */
+  void clear();
+  /** print map */
+  void printStatus(double t);
+
+private:
+  /** grid cell of a position */
+  long long cellKey(float x, float y);
+  long long cellKey(int cx, int cy)
+  {
+    return ((long long)cx << 32) | (unsigned int)cy;
+  }
+  /** remove objects with too low confidence, and rebuild index */
+  void prune(double t);
+  //
+  mutex lock;
+  vector<UMapObject> objects;
+  /// grid index: cell key to object index
+  unordered_map<long long, vector<int>> grid;
+  /// grid cell size [m]
+  const float cellSize = 0.25;
+  int addCnt = 0;
+};
+
+#endif
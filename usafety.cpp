@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <pthread.h>
+#include <unistd.h>
+#include "usafety.h"
+
+USafety::USafety(UBridge *reg, UCmdChannel *cmdChannel)
+{
+  bridge = reg;
+  channel = cmdChannel;
+  th1 = NULL;
+  th1stop = false;
+}
+
+USafety::~USafety()
+{
+  stop();
+}
+
+void USafety::start()
+{
+  if (bridge != NULL and sim == NULL and th1 == NULL)
+  {
+    th1stop = false;
+    th1 = new thread(runObj, this);
+    // monitor should run before mission and camera threads
+    sched_param sp;
+    sp.sched_priority = 50;
+    isRealTime = pthread_setschedparam(th1->native_handle(), SCHED_FIFO, &sp) == 0;
+    if (not isRealTime)
+      printf("# USafety:: could not get real-time priority (needs root), running with normal priority\n");
+  }
+}
+
+void USafety::stop()
+{
+  th1stop = true;
+  if (th1 != NULL)
+  {
+    th1->join();
+    delete th1;
+    th1 = NULL;
+  }
+}
+
+void USafety::setSim(USim *simulator)
+{
+  // simulated time is advanced by mission thread, that calls check()
+  stop();
+  sim = simulator;
+}
+
+int USafety::addPredicate(Source source, bool below, float limit, const char *name)
+{
+  if (th1 != NULL)
+  {
+    printf("# USafety::addPredicate: monitor is running, '%s' not added\n", name);
+    return -1;
+  }
+  if (predicateCnt >= MAX_PREDICATES)
+  {
+    printf("# USafety::addPredicate: no space for '%s'\n", name);
+    return -1;
+  }
+  Predicate &p = predicates[predicateCnt];
+  p.source = source;
+  p.below = below;
+  p.limit = limit;
+  p.name = name;
+  p.enabled = false;
+  p.tripped = false;
+  return predicateCnt++;
+}
+
+void USafety::enable(int predicate, bool enabled)
+{
+  if (predicate >= 0 and predicate < predicateCnt)
+  {
+    predicates[predicate].tripped = false;
+    predicates[predicate].enabled = enabled;
+  }
+}
+
+bool USafety::isTripped(int predicate)
+{
+  if (predicate < 0 or predicate >= predicateCnt)
+    return false;
+  return predicates[predicate].tripped.exchange(false);
+}
+
+float USafety::value(Source source)
+{
+  if (sim != NULL)
+  { // simulator has IR only
+    switch (source)
+    {
+    case SRC_IR1: return sim->irdist[0];
+    case SRC_IR2: return sim->irdist[1];
+    default: return 0;
+    }
+  }
+  switch (source)
+  {
+  case SRC_IR1: return bridge->irdist->dist[0];
+  case SRC_IR2: return bridge->irdist->dist[1];
+  case SRC_TILT: return atan2(bridge->imu->acc[0], bridge->imu->acc[2]);
+  case SRC_CURRENT_LEFT: return bridge->motor->motorCurrent[0];
+  case SRC_CURRENT_RIGHT: return bridge->motor->motorCurrent[1];
+  default: return 0;
+  }
+}
+
+void USafety::check()
+{
+  checkCnt++;
+  for (int i = 0; i < predicateCnt; i++)
+  {
+    Predicate &p = predicates[i];
+    if (not p.enabled or p.tripped)
+      continue;
+    float v = value(p.source);
+    if ((p.below and v < p.limit) or (not p.below and v > p.limit))
+    { // preempt mission - start the hold thread
+      const int MSL = 30;
+      char s[MSL];
+      snprintf(s, MSL, "<event=%d\n", holdEvent);
+      channel->send(s);
+      p.tripped = true;
+      p.tripCnt++;
+      printf("# USafety:: '%s' tripped (value %.3f)\n", p.name, v);
+    }
+  }
+}
+
+/**
+ * Monitor thread, tests predicates when sensor values change.
+ * Polls at 1ms, that is faster than the REGBOT data streams. */
+void USafety::run()
+{
+  float last[SRC_CNT] = {0};
+  while (not th1stop)
+  {
+    bool changed = false;
+    for (int i = 0; i < SRC_CNT; i++)
+    {
+      float v = value(Source(i));
+      if (v != last[i])
+      {
+        last[i] = v;
+        changed = true;
+      }
+    }
+    if (changed)
+      check();
+    usleep(1000);
+  }
+}
+
+void USafety::printStatus()
+{
+  printf("# safety monitor: real-time=%d, %d checks, hold event %d\n", isRealTime, checkCnt, holdEvent);
+  for (int i = 0; i < predicateCnt; i++)
+  {
+    Predicate &p = predicates[i];
+    printf("#   %d '%s' %c %g: enabled=%d, tripped=%d (%d times)\n",
+           i, p.name, p.below ? '<' : '>', p.limit, p.enabled.load(), p.tripped.load(), p.tripCnt);
+  }
+}
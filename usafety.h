@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef USAFETY_H
+#define USAFETY_H
+
+#include <atomic>
+#include "urun.h"
+#include "ubridge.h"
+#include "ucmdchannel.h"
+#include "usim.h"
+
+/**
+ * Reactive safety monitor.
+ * A high priority thread tests a set of sensor predicates (e.g. IR distance
+ * below a limit) on every bridge update. When an enabled predicate trips,
+ * the REGBOT hold thread is started at once (one event), that stops the
+ * running mission snippet, and the mission thread is told through isTripped().
+ * The hold thread is loaded by the mission in missionInit(). */
+class USafety : public URun
+{
+public:
+  /// sensor values that can be tested
+  enum Source {SRC_IR1, SRC_IR2, SRC_TILT, SRC_CURRENT_LEFT, SRC_CURRENT_RIGHT, SRC_CNT};
+  /// max number of predicates
+  const static int MAX_PREDICATES = 8;
+  /// event that starts the REGBOT hold thread (stopping the running snippet)
+  int holdEvent = 27;
+
+public:
+  /** Constructor - the monitor thread is started by start() */
+  USafety(UBridge *reg, UCmdChannel *cmdChannel);
+  /** destructor */
+  ~USafety();
+  /**
+   * Use simulator as source - then check() must be called by
+   * the thread that advances the simulation */
+  void setSim(USim *simulator);
+  /**
+   * Add a predicate, it is disabled until enable(..., true)
+   * \param source is the sensor value to test
+   * \param below if true, trips when value < limit, else when value > limit
+   * \param limit is the limit value (meter, radians or ampere)
+   * \param name is used in messages
+   * Predicates must be added before start(), as the monitor thread reads the table unlocked.
+   * \returns predicate index, or -1 if no space or monitor is started */
+  int addPredicate(Source source, bool below, float limit, const char *name);
+  /** enable or disable a predicate */
+  void enable(int predicate, bool enabled);
+  /**
+   * Test if a predicate has tripped (since last call)
+   * clears the flag and rearms the predicate.
+   * \returns true if tripped */
+  bool isTripped(int predicate);
+  /**
+   * Test if a predicate has tripped, without clearing the flag
+   * (e.g. to hold back new motion until the trip is handled) */
+  bool isPending(int predicate)
+  {
+    return predicate >= 0 and predicate < predicateCnt and predicates[predicate].tripped;
+  }
+  /**
+   * Test all predicates against current sensor values.
+   * Called by the monitor thread on every bridge update */
+  void check();
+  /** print status */
+  void printStatus();
+  /**
+   * Start the monitor thread (if there is a bridge),
+   * after all predicates are added */
+  void start();
+  /** stop monitor thread */
+  void stop();
+  /** monitor thread */
+  void run();
+
+private:
+  struct Predicate
+  {
+    Source source;
+    bool below;
+    float limit;
+    const char *name;
+    std::atomic<bool> enabled{false};
+    std::atomic<bool> tripped{false};
+    int tripCnt = 0;
+  };
+  /** current value of sensor */
+  float value(Source source);
+  //
+  UBridge *bridge;
+  UCmdChannel *channel;
+  USim *sim = NULL;
+  Predicate predicates[MAX_PREDICATES];
+  int predicateCnt = 0;
+  /// statistics
+  int checkCnt = 0;
+  bool isRealTime = false;
+};
+
+#endif
@@ -0,0 +1,717 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+
+#include "usim.h"
+
+/// distance between wheels [m]
+#define SIM_WHEEL_BASE 0.16
+/// line sensor and IR2 distance in front of wheel axis [m]
+#define SIM_SENSOR_FWD 0.10
+/// max range of IR sensors [m]
+#define SIM_IR_MAX 1.5
+/// simulation step [sec]
+#define SIM_DT 0.002
+
+/**
+ * REGBOT code for the condition that ended a line, tested with 'last=N'.
+ * The missions use 'last=8' for 'dist' */
+static int condCode(const string &name)
+{
+  const char *names[] = {"time", "turn", "xl", "lv", "ir1", "ir2", "event", "dist", "head", NULL};
+  for (int i = 0; names[i] != NULL; i++)
+    if (name == names[i])
+      return i + 1;
+  return 0;
+}
+
+static float limitToPi(float a)
+{
+  while (a > M_PI)
+    a -= 2 * M_PI;
+  while (a < -M_PI)
+    a += 2 * M_PI;
+  return a;
+}
+
+USim::USim()
+{
+  // default world: 4m straight line along x-axis, crossing at the end
+  lines.push_back({-0.5, 0, 4.0, 0});
+  crossings.push_back({3.0, 0, 0, 0});
+  reset();
+}
+
+void USim::reset()
+{
+  lock_guard<mutex> guard(lock);
+  threads.clear();
+  clearEvents();
+  simTime = 0;
+  x = startX;
+  y = startY;
+  h = startH;
+  vel = 0;
+  velRef = 0;
+  acc = 1;
+  mode = DRIVE_VEL;
+  odoDist = 0;
+  odoTurn = 0;
+  started = false;
+  cmdCnt = 0;
+  updateSensors();
+}
+
+bool USim::loadWorld(const char *filename)
+{
+  FILE *f = fopen(filename, "r");
+  if (f == NULL)
+  {
+    printf("# USim::loadWorld: failed to open %s\n", filename);
+    return false;
+  }
+  lines.clear();
+  crossings.clear();
+  obstacles.clear();
+  balls.clear();
+  const int MSL = 200;
+  char s[MSL];
+  while (fgets(s, MSL, f) != NULL)
+  {
+    float a[5] = {0};
+    if (s[0] == '%' or s[0] == '#')
+      continue;
+    if (sscanf(s, "line %f %f %f %f", &a[0], &a[1], &a[2], &a[3]) == 4)
+      lines.push_back({a[0], a[1], a[2], a[3]});
+    else if (sscanf(s, "cross %f %f", &a[0], &a[1]) == 2)
+      crossings.push_back({a[0], a[1], 0, 0});
+    else if (sscanf(s, "obstacle %f %f %f", &a[0], &a[1], &a[2]) == 3)
+      obstacles.push_back({a[0], a[1], a[2], 0});
+    else if (sscanf(s, "lead %f %f %f %f", &a[0], &a[1], &a[2], &a[3]) == 4)
+      obstacles.push_back({a[0], a[1], a[2], a[3]});
+    else if (sscanf(s, "ball %f %f", &a[0], &a[1]) == 2)
+      balls.push_back({a[0], a[1], 0.021, 0});
+    else if (sscanf(s, "robot %f %f %f", &a[0], &a[1], &a[2]) == 3)
+    {
+      startX = a[0];
+      startY = a[1];
+      startH = a[2] * M_PI / 180.0;
+    }
+  }
+  fclose(f);
+  reset();
+  return true;
+}
+
+void USim::printStatus()
+{
+  printf("# ------- Simulator ----------\n");
+  printf("# time=%.3fs (scale %g), started=%d, commands=%d\n", simTime, timeScale, started, cmdCnt);
+  printf("# pose (%.3fx, %.3fy, %.1fdeg), vel=%.2f m/s, ir=(%.2f, %.2f), lv=%.0f, xl=%.0f\n",
+         x, y, h * 180 / M_PI, vel, irdist[0], irdist[1], lv, xl);
+  printf("# world: %d lines, %d crossings, %d obstacles, %d balls\n",
+         (int)lines.size(), (int)crossings.size(), (int)obstacles.size(), (int)balls.size());
+  for (auto &th : threads)
+    printf("# thread %d: %d lines, running=%d, line=%d\n", th.number, (int)th.lines.size(), th.running, th.pc + 1);
+}
+
+//////////////////////////////////////////////////
+
+void USim::parseLine(const char *s, Line &line)
+{
+  line.assign.clear();
+  line.cond.clear();
+  const char *p = s;
+  vector<Item> *dest = &line.assign;
+  while (*p != '\0')
+  { // one item at a time, ended by ',', ':' or end of line
+    size_t n = strcspn(p, ",:\n\r");
+    string it(p, n);
+    size_t op = it.find_first_of("=<>");
+    if (op != string::npos)
+    {
+      Item item;
+      size_t b = it.find_first_not_of(" \t");
+      size_t e = it.find_last_not_of(" \t", op - 1);
+      item.name = (e >= b and e != string::npos) ? it.substr(b, e - b + 1) : "";
+      item.op = it[op];
+      item.value = strtof(it.c_str() + op + 1, NULL);
+      if (dest == &line.cond and not knownCond(item.name))
+      { // the mission would wait for something the simulator can not give
+        errorCnt++;
+        bool reported = false;
+        for (auto &u : unknownCond)
+          reported |= u == item.name;
+        if (not reported)
+        {
+          printf("# USim::parseLine: unknown condition '%s' in '%.*s'\n", item.name.c_str(),
+                 (int)strcspn(s, "\n\r"), s);
+          unknownCond.push_back(item.name);
+        }
+      }
+      dest->push_back(item);
+    }
+    p += n;
+    if (*p == ':')
+      dest = &line.cond;
+    if (*p != '\0')
+      p++;
+  }
+}
+
+bool USim::knownCond(const string &name)
+{ // the conditions tested in testCond()
+  const char *known[] = {"time", "dist", "turn", "xl", "lv", "ir1", "ir2", "event", "last", "head"};
+  for (auto k : known)
+    if (name == k)
+      return true;
+  return false;
+}
+
+USim::Thread *USim::findThread(int number)
+{
+  for (auto &th : threads)
+    if (th.number == number)
+      return &th;
+  return NULL;
+}
+
+void USim::send(const char *cmd)
+{
+  lock_guard<mutex> guard(lock);
+  const char *p = cmd;
+  cmdCnt++;
+  if (replay != NULL)
+  { // display status depends on timing only, so not compared
+    if (verbose)
+      printf("# replay %.3f: %s", simTime, cmd);
+    if (strncmp(cmd, "oled ", 5) != 0)
+      replay->compare(cmd, simTime);
+    // the simulated REGBOT reacts at once (e.g. event 33 on 'start'),
+    // so inputs recorded at this time are available before the next loop pass
+    UTraffic::Record r;
+    while (replay->nextInput(simTime, r))
+      playInput(r);
+    return;
+  }
+  while (*p != '\0')
+  { // may be more commands separated by new-line
+    size_t n = strcspn(p, "\n");
+    string c(p, n);
+    p += n;
+    if (*p == '\n')
+      p++;
+    if (verbose)
+      printf("# sim %.3f: %s\n", simTime, c.c_str());
+    // commands to REGBOT may be prefixed by 'robot'
+    if (c.compare(0, 6, "robot ") == 0)
+      c = c.substr(6);
+    if (c.compare(0, 11, "<add thread") == 0)
+    {
+      Thread th;
+      Line ln;
+      parseLine(c.c_str() + 4, ln);
+      for (auto &a : ln.assign)
+      {
+        if (a.name == "thread")
+          th.number = int(a.value);
+        else if (a.name == "event")
+          th.startEvent = int(a.value);
+      }
+      for (auto &cd : ln.cond)
+        if (cd.name == "event")
+          th.stopEvents.push_back(int(cd.value));
+      threads.push_back(th);
+    }
+    else if (c.compare(0, 4, "<add") == 0)
+    {
+      Line ln;
+      parseLine(c.c_str() + 4, ln);
+      if (threads.empty())
+      { // lines before first thread is thread 1
+        threads.push_back(Thread());
+        threads.back().number = 1;
+      }
+      threads.back().lines.push_back(ln);
+    }
+    else if (c.compare(0, 4, "<mod") == 0)
+    {
+      int t, l, pos = 0;
+      if (sscanf(c.c_str() + 4, "%d %d %n", &t, &l, &pos) >= 2 and l > 0)
+      {
+        Thread *th = findThread(t);
+        if (th != NULL)
+        {
+          if ((int)th->lines.size() < l)
+            th->lines.resize(l);
+          parseLine(c.c_str() + 4 + pos, th->lines[l - 1]);
+        }
+      }
+    }
+    else if (c.compare(0, 7, "<event=") == 0)
+      setEvent(atoi(c.c_str() + 7));
+    else if (c.compare(0, 6, "<clear") == 0)
+      threads.clear();
+    else if (c.compare(0, 5, "start") == 0)
+    { // start threads without start event
+      started = true;
+      for (auto &th : threads)
+      {
+        if (th.startEvent < 0)
+        {
+          th.running = true;
+          th.pc = 0;
+          th.entered = false;
+        }
+      }
+      hostEvent[33] = true;
+    }
+    else if (c.compare(0, 4, "stop") == 0)
+    {
+      started = false;
+      for (auto &th : threads)
+        th.running = false;
+      velRef = 0;
+      hostEvent[0] = true;
+    }
+    // oled, subscribe and other bridge commands have no effect
+  }
+}
+
+bool USim::isEventSet(int event)
+{
+  if (event < 0 or event >= 34)
+    return false;
+  lock_guard<mutex> guard(lock);
+  bool is = hostEvent[event];
+  hostEvent[event] = false;
+  return is;
+}
+
+void USim::clearEvents()
+{
+  if (replay != NULL)
+    // replayed events are events seen by the mission, so must not be lost
+    return;
+  for (int i = 0; i < 34; i++)
+    hostEvent[i] = false;
+}
+
+void USim::setEvent(int event)
+{
+  if (event < 0 or event >= 34)
+    return;
+  hostEvent[event] = true;
+  for (auto &th : threads)
+  { // stop first
+    if (th.running)
+    {
+      th.eventsSince |= 1u << (event & 31);
+      for (int e : th.stopEvents)
+        if (e == event)
+          th.running = false;
+    }
+  }
+  for (auto &th : threads)
+  {
+    if (th.startEvent == event)
+    {
+      th.running = true;
+      th.pc = 0;
+      th.entered = false;
+    }
+  }
+}
+
+//////////////////////////////////////////////////
+
+void USim::playInput(const UTraffic::Record &r)
+{
+  switch (r.type)
+  {
+  case UTraffic::TR_EVENT:
+    if (r.arg < 34)
+      hostEvent[r.arg] = true;
+    break;
+  case UTraffic::TR_POSE:
+    x = r.v[0];
+    y = r.v[1];
+    h = r.v[2];
+    break;
+  case UTraffic::TR_IR:
+    irdist[0] = r.v[0];
+    irdist[1] = r.v[1];
+    break;
+  case UTraffic::TR_VEL:
+    vel = r.v[0];
+    break;
+  default:
+    break;
+  }
+}
+
+double USim::time()
+{
+  lock_guard<mutex> guard(lock);
+  return simTime;
+}
+
+void USim::advance(double seconds)
+{
+  int n = int(seconds / SIM_DT + 0.5);
+  if (replay != NULL)
+  { // recorded inputs up to the new time
+    lock_guard<mutex> guard(lock);
+    // same steps as simulation, so that recorded times are reached exactly
+    for (int i = 0; i < n; i++)
+      simTime += SIM_DT;
+    UTraffic::Record r;
+    while (replay->nextInput(simTime, r))
+      playInput(r);
+  }
+  else
+  {
+    lock_guard<mutex> guard(lock);
+    for (int i = 0; i < n; i++)
+      step(SIM_DT);
+  }
+  if (timeScale > 0)
+    usleep(int(seconds * 1e6 / timeScale));
+}
+
+bool USim::enterLine(Thread &th, Line &ln)
+{
+  bool hasTr = false, hasHead = false, hasEdge = false;
+  for (auto &a : ln.assign)
+  {
+    if (a.name == "vel")
+      velRef = a.value;
+    else if (a.name == "acc")
+      acc = a.value;
+    else if (a.name == "tr")
+    { // positive radius turns left, unless a turn condition says otherwise
+      tr = fabs(a.value);
+      turnSign = a.value < 0 ? -1 : 1;
+      hasTr = true;
+    }
+    else if (a.name == "head")
+    {
+      headRef = a.value * M_PI / 180.0;
+      hasHead = true;
+    }
+    else if (a.name == "edgel" or a.name == "edger")
+    {
+      edgeLeft = a.name == "edgel";
+      hasEdge = true;
+    }
+    else if (a.name == "event")
+      setEvent(int(a.value));
+    // white, log, servo, pservo, irsensor, label and goto has no effect here
+  }
+  for (auto &c : ln.cond)
+    if (c.name == "turn")
+      turnSign = c.value < 0 ? -1 : 1;
+  if (hasTr)
+    mode = DRIVE_TURN;
+  else if (hasHead)
+    mode = DRIVE_HEAD;
+  else if (hasEdge)
+    mode = DRIVE_EDGE;
+  else if (mode != DRIVE_EDGE and not ln.assign.empty())
+    // edge following continues until turn or heading control
+    mode = DRIVE_VEL;
+  th.t0 = simTime;
+  th.dist0 = odoDist;
+  th.turn0 = odoTurn;
+  th.eventsSince = 0;
+  th.entered = true;
+  return true;
+}
+
+static bool compare(float v, char op, float ref)
+{
+  if (op == '<')
+    return v < ref;
+  if (op == '>')
+    return v > ref;
+  return v >= ref;
+}
+
+bool USim::testCond(Thread &th, const Item &c, bool &instant)
+{
+  instant = false;
+  if (c.name == "time")
+    return compare(simTime - th.t0, c.op, c.value);
+  if (c.name == "dist")
+    return compare(fabs(odoDist - th.dist0), c.op, fabs(c.value));
+  if (c.name == "turn")
+  {
+    float turned = (odoTurn - th.turn0) * 180 / M_PI;
+    if (c.op == '=')
+      return c.value >= 0 ? turned >= c.value : turned <= c.value;
+    return compare(turned, c.op, c.value);
+  }
+  if (c.name == "xl")
+    return compare(xl, c.op, c.value);
+  if (c.name == "lv")
+    return compare(lv, c.op, c.value);
+  if (c.name == "ir1")
+    return compare(irdist[0], c.op, c.value);
+  if (c.name == "ir2")
+    return compare(irdist[1], c.op, c.value);
+  if (c.name == "event")
+    return (th.eventsSince & (1u << (int(c.value) & 31))) != 0;
+  if (c.name == "last")
+  {
+    instant = true;
+    return th.lastCond == int(c.value);
+  }
+  if (c.name == "head")
+    return fabs(limitToPi(headRef - h)) < 0.02;
+  // unknown condition - reported when the line was added, never true
+  return false;
+}
+
+void USim::stepThread(Thread &th)
+{ // lines that do not wait are all done in this step
+  for (int n = 0; n < 50 and th.running; n++)
+  {
+    if (th.pc >= (int)th.lines.size())
+    { // no more lines
+      th.running = false;
+      break;
+    }
+    Line &ln = th.lines[th.pc];
+    if (not th.entered)
+      enterLine(th, ln);
+    bool ended = ln.cond.empty();
+    bool instantOnly = true;
+    int code = 0;
+    for (auto &c : ln.cond)
+    {
+      bool instant;
+      if (testCond(th, c, instant))
+      {
+        ended = true;
+        code = condCode(c.name);
+        break;
+      }
+      instantOnly &= instant;
+    }
+    if (not ended and instantOnly)
+    { // e.g. 'goto=1:last=8', not true, so just next line
+      th.pc++;
+      th.entered = false;
+      continue;
+    }
+    if (not ended)
+      // wait for condition
+      break;
+    if (code > 0)
+      th.lastCond = code;
+    th.entered = false;
+    th.pc++;
+    for (auto &a : ln.assign)
+    {
+      if (a.name == "goto")
+      { // continue at label
+        for (int i = 0; i < (int)th.lines.size(); i++)
+          for (auto &b : th.lines[i].assign)
+            if (b.name == "label" and int(b.value) == int(a.value))
+              th.pc = i;
+      }
+    }
+  }
+}
+
+void USim::step(double dt)
+{
+  if (started)
+    for (auto &th : threads)
+      if (th.running)
+        stepThread(th);
+  // velocity with acceleration limit
+  float aLim = acc > 0.01 ? acc : 100;
+  float dv = velRef - vel;
+  if (fabs(dv) > aLim * dt)
+    dv = copysignf(aLim * dt, dv);
+  vel += dv;
+  float v = vel, w = 0;
+  switch (mode)
+  {
+  case DRIVE_TURN:
+    if (tr < 0.01)
+    { // turn on the spot, vel is wheel velocity
+      v = 0;
+      w = turnSign * fabs(vel) / (SIM_WHEEL_BASE / 2);
+    }
+    else
+      w = turnSign * fabs(vel) / tr;
+    break;
+  case DRIVE_HEAD:
+  {
+    float e = limitToPi(headRef - h);
+    w = fmaxf(-2, fminf(2, 3 * e));
+    break;
+  }
+  case DRIVE_EDGE:
+    if (vel > 0.01)
+    { // pure pursuit on the line edge
+      float sx = x + SIM_SENSOR_FWD * cos(h);
+      float sy = y + SIM_SENSOR_FWD * sin(h);
+      float tx, ty, lat;
+      float d = lineDist(sx, sy, tx, ty, lat);
+      if (d < 0.1)
+      {
+        if (tx * cos(h) + ty * sin(h) < 0)
+        { // follow line in driving direction
+          tx = -tx;
+          ty = -ty;
+          lat = -lat;
+        }
+        // target is the edge 0.15m ahead
+        float edge = edgeLeft ? 0.01 : -0.01;
+        float gx = sx - (lat - edge) * -ty + 0.15 * tx - x;
+        float gy = sy - (lat - edge) * tx + 0.15 * ty - y;
+        float alpha = limitToPi(atan2(gy, gx) - h);
+        float ld = sqrt(gx * gx + gy * gy);
+        w = 2 * v * sin(alpha) / ld;
+      }
+    }
+    break;
+  default:
+    break;
+  }
+  x += v * cos(h) * dt;
+  y += v * sin(h) * dt;
+  h = limitToPi(h + w * dt);
+  odoDist += fabs(v) * dt;
+  odoTurn += w * dt;
+  // moving obstacles follow the first line
+  if (not lines.empty())
+  {
+    float lx = lines[0].x2 - lines[0].x1;
+    float ly = lines[0].y2 - lines[0].y1;
+    float ll = sqrt(lx * lx + ly * ly);
+    for (auto &o : obstacles)
+    {
+      if (o.v != 0 and ll > 0)
+      {
+        o.x += o.v * dt * lx / ll;
+        o.y += o.v * dt * ly / ll;
+      }
+    }
+  }
+  simTime += dt;
+  updateSensors();
+}
+
+//////////////////////////////////////////////////
+
+float USim::lineDist(float px, float py, float &tx, float &ty, float &lat)
+{
+  float best = 1e6;
+  tx = 1;
+  ty = 0;
+  lat = 0;
+  for (auto &s : lines)
+  {
+    float dx = s.x2 - s.x1, dy = s.y2 - s.y1;
+    float l2 = dx * dx + dy * dy;
+    if (l2 < 1e-6)
+      continue;
+    float u = ((px - s.x1) * dx + (py - s.y1) * dy) / l2;
+    u = fmaxf(0, fminf(1, u));
+    float cx = s.x1 + u * dx - px, cy = s.y1 + u * dy - py;
+    float d = sqrt(cx * cx + cy * cy);
+    if (d < best)
+    {
+      float l = sqrt(l2);
+      best = d;
+      tx = dx / l;
+      ty = dy / l;
+      // positive when point is left of line
+      lat = (tx * (py - s.y1) - ty * (px - s.x1));
+    }
+  }
+  return best;
+}
+
+float USim::rayDist(float ox, float oy, float dir, float maxDist)
+{
+  float best = maxDist;
+  float dx = cos(dir), dy = sin(dir);
+  for (auto &o : obstacles)
+  {
+    float fx = o.x - ox, fy = o.y - oy;
+    float t = fx * dx + fy * dy;
+    float d2 = fx * fx + fy * fy - t * t;
+    if (t > 0 and d2 < o.r * o.r)
+    {
+      float hit = t - sqrt(o.r * o.r - d2);
+      if (hit >= 0 and hit < best)
+        best = hit;
+    }
+  }
+  return best;
+}
+
+void USim::updateSensors()
+{
+  float sx = x + SIM_SENSOR_FWD * cos(h);
+  float sy = y + SIM_SENSOR_FWD * sin(h);
+  float tx, ty, lat;
+  float d = lineDist(sx, sy, tx, ty, lat);
+  lv = 20 * fmaxf(0, 1 - d / 0.03);
+  xl = 0;
+  for (auto &c : crossings)
+    if (hypot(c.x - sx, c.y - sy) < 0.03)
+      xl = 20;
+  // ir1 is pointing left, ir2 forward
+  irdist[0] = rayDist(x - 0.08 * sin(h), y + 0.08 * cos(h), h + M_PI / 2, SIM_IR_MAX);
+  irdist[1] = rayDist(sx, sy, h, SIM_IR_MAX);
+}
+
+bool USim::detectBall(float &distance, float &angle)
+{
+  lock_guard<mutex> guard(lock);
+  bool found = false;
+  distance = 0;
+  angle = 0;
+  for (auto &b : balls)
+  {
+    float dx = b.x - x, dy = b.y - y;
+    float r = sqrt(dx * dx + dy * dy);
+    float a = limitToPi(atan2(dy, dx) - h);
+    // camera field of view is about +/- 30 degrees
+    if (fabs(a) < 30 * M_PI / 180 and r < 2.0 and (not found or r * 1000 < distance))
+    {
+      distance = r * 1000;
+      angle = a * 180 / M_PI;
+      found = true;
+    }
+  }
+  return found;
+}
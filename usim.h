@@ -0,0 +1,195 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef USIM_H
+#define USIM_H
+
+#include <vector>
+#include <string>
+#include <mutex>
+#include "utraffic.h"
+
+using namespace std;
+
+/**
+ * Local stand-in for the bridge and REGBOT.
+ * Accepts the bridge commands used by the mission
+ * ('robot <add ...', '<mod ...', '<event=N', '<clear', 'start', 'stop', 'oled ...'),
+ * interprets the mission snippets and drives a differential drive
+ * robot in a simple world with lines, crossings and obstacles.
+ *
+ * The simulation is stepped by the mission thread through advance(),
+ * so it runs in simulated time: real-time if timeScale=1,
+ * faster with timeScale > 1, and as fast as possible with timeScale=0.
+ *
+ * In replay mode the robot is not simulated, the inputs (events, pose,
+ * IR and velocity) are taken from a recorded traffic trace at their recorded
+ * time, and the mission commands are compared with the recorded commands.
+ * */
+class USim
+{
+public:
+  /// simulated time since start [sec]
+  double simTime = 0;
+  /// time scale 1 = real-time, 10 is 10 times faster, 0 is as fast as possible
+  float timeScale = 0;
+  /// robot pose (x,y in meter, h in radians)
+  float x = 0, y = 0, h = 0;
+  /// IR distance sensors 0=ir1 (pointing left), 1=ir2 (pointing forward) [m]
+  float irdist[2] = {1.5, 1.5};
+  /// line sensor values - line valid (lv) and crossing (xl) - 0..20
+  float lv = 0, xl = 0;
+  /// robot velocity [m/s]
+  float velocity()
+  {
+    return vel;
+  }
+  /// robot is started (received 'start')
+  bool started = false;
+  /// print received commands
+  bool verbose = false;
+  /// commands received
+  int cmdCnt = 0;
+  /// mission lines with a condition the simulator does not know (the run is not valid)
+  int errorCnt = 0;
+  /// recorded traffic to replay (instead of simulation), if not NULL
+  UTraffic *replay = NULL;
+
+public:
+  /** Constructor - with default world (straight line) */
+  USim();
+  /**
+   * load world from file, a line for each element (x,y,r in meter, h in degrees):
+   *   line x1 y1 x2 y2      - line to follow (white tape)
+   *   cross x y             - crossing line (gives xl)
+   *   obstacle x y r        - round obstacle seen by IR sensors
+   *   lead x y r v          - obstacle moving along the first line with velocity v (robot to follow)
+   *   ball x y              - ball seen by ball detection
+   *   robot x y h           - start pose of robot
+   * lines starting with '%' or '#' are comments.
+   * \returns true if loaded */
+  bool loadWorld(const char *filename);
+  /**
+   * a command for the bridge (or REGBOT) - same format as UBridge::send() */
+  void send(const char *cmd);
+  /**
+   * test (and clear) event flag - same as UEvent::isEventSet() */
+  bool isEventSet(int event);
+  /** clear all event flags */
+  void clearEvents();
+  /**
+   * Advance simulated time, and if not as-fast-as-possible, wait
+   * the corresponding (scaled) real time.
+   * \param seconds is the time to advance */
+  void advance(double seconds);
+  /**
+   * Simulated ball detection (as UCamera::processBallDetection())
+   * \param distance is distance to nearest visible ball in mm (from robot center)
+   * \param angle is angle to ball in degrees (positive is left)
+   * \returns true if a ball is in view */
+  bool detectBall(float &distance, float &angle);
+  /** simulated time [sec] - for other threads than the mission thread */
+  double time();
+  /** reset robot, REGBOT mission and time - keeps the world */
+  void reset();
+  /** print simulator status */
+  void printStatus();
+
+private:
+  /// one assignment or condition in a mission line
+  struct Item
+  {
+    string name;
+    char op; // '=', '<' or '>'
+    float value;
+  };
+  /// one mission line
+  struct Line
+  {
+    vector<Item> assign;
+    vector<Item> cond;
+  };
+  /// one REGBOT mission thread
+  struct Thread
+  {
+    int number = 0;
+    int startEvent = -1;
+    vector<int> stopEvents;
+    vector<Line> lines;
+    bool running = false;
+    int pc = 0;
+    bool entered = false;
+    // line start values
+    double t0 = 0;
+    float dist0 = 0;
+    float turn0 = 0;
+    unsigned int eventsSince = 0;
+    /// code of condition that ended last line (REGBOT 'last')
+    int lastCond = 0;
+  };
+  /// world elements
+  struct Seg
+  {
+    float x1, y1, x2, y2;
+  };
+  struct Obst
+  {
+    float x, y, r, v;
+  };
+  vector<Seg> lines;
+  vector<Obst> crossings; // r not used
+  vector<Obst> obstacles; // v is velocity along first line (0 for fixed)
+  vector<Obst> balls;
+  float startX = 0, startY = 0, startH = 0;
+  /// REGBOT mission
+  vector<Thread> threads;
+  /// event flags seen by host (cleared by isEventSet)
+  bool hostEvent[34];
+  /// control references set by mission lines
+  enum DriveMode {DRIVE_VEL, DRIVE_TURN, DRIVE_HEAD, DRIVE_EDGE};
+  DriveMode mode = DRIVE_VEL;
+  float velRef = 0, acc = 1, tr = 0, turnSign = 1;
+  float headRef = 0;
+  bool edgeLeft = true;
+  /// robot state
+  float vel = 0;
+  float odoDist = 0;
+  float odoTurn = 0; // accumulated heading change (radians)
+  /// unknown condition names already reported
+  vector<string> unknownCond;
+  /// mutex as mission and safety threads may send
+  mutex lock;
+  //
+  void parseLine(const char *s, Line &line);
+  bool knownCond(const string &name);
+  void setEvent(int event);
+  void step(double dt);
+  /** use a recorded input (replay mode) */
+  void playInput(const UTraffic::Record &r);
+  void stepThread(Thread &th);
+  bool enterLine(Thread &th, Line &ln);
+  bool testCond(Thread &th, const Item &c, bool &instant);
+  void updateSensors();
+  float rayDist(float ox, float oy, float dir, float maxDist);
+  float lineDist(float px, float py, float &tx, float &ty, float &lat);
+  Thread *findThread(int number);
+};
+
+#endif
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <cmath>
+#include <time.h>
+#include <unistd.h>
+#include "usubscriptions.h"
+
+const USubscriptions::StreamDef USubscriptions::streams[SUB_STREAM_CNT] =
+{
+  {"pose",   100, 70},
+  {"edge",   100, 60},
+  {"motor",  100, 50},
+  {"event",    0, 12},
+  {"joy",     10, 80},
+  {"info",     1, 100},
+  {"irdist", 100, 30},
+  {"imu",    100, 80},
+};
+
+USubscriptions::USubscriptions(UBridge *reg)
+{
+  bridge = reg;
+  th1 = NULL;
+  th1stop = false;
+  for (int s = 0; s < SUB_STREAM_CNT; s++)
+  {
+    alwaysNeeded[s] = false;
+    subscribed[s] = false;
+    for (int m = 0; m < MAX_MISSIONS; m++)
+      needed[m][s] = false;
+  }
+}
+
+USubscriptions::~USubscriptions()
+{
+  th1stop = true;
+  if (th1 != NULL)
+  {
+    th1->join();
+    delete th1;
+    th1 = NULL;
+  }
+}
+
+double USubscriptions::now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+double USubscriptions::cpuTime()
+{
+  timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void USubscriptions::always(int stream)
+{
+  if (stream >= 0 and stream < SUB_STREAM_CNT)
+    alwaysNeeded[stream] = true;
+}
+
+void USubscriptions::need(int mission, int stream)
+{
+  if (mission > 0 and mission < MAX_MISSIONS and stream >= 0 and stream < SUB_STREAM_CNT)
+    needed[mission][stream] = true;
+}
+
+void USubscriptions::subscribe(int stream)
+{ // the bridge default rate is the only one available
+  switch (stream)
+  {
+  case SUB_POSE: bridge->pose->subscribe(); break;
+  case SUB_EDGE: bridge->edge->subscribe(); break;
+  case SUB_MOTOR: bridge->motor->subscribe(); break;
+  case SUB_EVENT: bridge->event->subscribe(); break;
+  case SUB_JOY: bridge->joy->subscribe(); break;
+  case SUB_INFO: bridge->info->subscribe(); break;
+  case SUB_IRDIST: bridge->irdist->subscribe(); break;
+  case SUB_IMU: bridge->imu->subscribe(); break;
+  default: return;
+  }
+  sendCnt++;
+}
+
+void USubscriptions::setMission(int mission)
+{
+  bool all = mission >= MAX_MISSIONS;
+  if (mission < 0 or all)
+    mission = 0;
+  {
+    lock_guard<mutex> guard(lock);
+    if (mission == active)
+      return;
+    double t = now(), c = cpuTime();
+    if (active >= 0)
+    { // end usage segment of last mission
+      usage[active].wall += t - segWall;
+      usage[active].cpu += c - segCpu;
+    }
+    active = mission;
+    segWall = t;
+    segCpu = c;
+  }
+  for (int s = 0; s < SUB_STREAM_CNT; s++)
+  {
+    bool need = all or alwaysNeeded[s] or needed[mission][s];
+    if (need and not subscribed[s])
+    { // simulated REGBOT sends what the mission needs
+      if (bridge != NULL)
+        subscribe(s);
+      subscribed[s] = true;
+    }
+  }
+  if (bridge != NULL and th1 == NULL)
+    th1 = new thread(runObj, this);
+}
+
+double USubscriptions::updateTime(int stream)
+{
+  switch (stream)
+  {
+  case SUB_POSE: return bridge->pose->updTime.getDecSec();
+  case SUB_EDGE: return bridge->edge->updTime.getDecSec();
+  case SUB_MOTOR: return bridge->motor->updTime.getDecSec();
+  case SUB_EVENT: return bridge->event->updTime.getDecSec();
+  case SUB_JOY: return bridge->joy->updTime.getDecSec();
+  case SUB_INFO: return bridge->info->updTime.getDecSec();
+  case SUB_IRDIST: return bridge->irdist->updTime.getDecSec();
+  case SUB_IMU: return bridge->imu->updTime.getDecSec();
+  default: return 0;
+  }
+}
+
+/**
+ * Counting thread.
+ * The bridge sets the update time of a data object for every message,
+ * tested every 1 ms, that is faster than any of the REGBOT streams. */
+void USubscriptions::run()
+{
+  double last[SUB_STREAM_CNT];
+  for (int s = 0; s < SUB_STREAM_CNT; s++)
+    last[s] = updateTime(s);
+  while (not th1stop)
+  {
+    int n[SUB_STREAM_CNT] = {0};
+    bool updated = false;
+    for (int s = 0; s < SUB_STREAM_CNT; s++)
+    {
+      double t = updateTime(s);
+      if (t != last[s])
+      {
+        last[s] = t;
+        n[s] = 1;
+        updated = true;
+      }
+    }
+    if (updated)
+    {
+      lock_guard<mutex> guard(lock);
+      for (int s = 0; s < SUB_STREAM_CNT; s++)
+        usage[active].msgs[s] += n[s];
+    }
+    usleep(1000);
+  }
+}
+
+void USubscriptions::printStatus()
+{
+  // copy, so that the mission and counting threads are not disturbed
+  Usage u[MAX_MISSIONS];
+  int act;
+  {
+    lock_guard<mutex> guard(lock);
+    for (int m = 0; m < MAX_MISSIONS; m++)
+      u[m] = usage[m];
+    act = active;
+    if (act >= 0)
+    { // include the running segment
+      u[act].wall += now() - segWall;
+      u[act].cpu += cpuTime() - segCpu;
+    }
+  }
+  printf("# ------- Subscriptions ----------\n");
+  printf("# %d subscriptions send, mission %d, subscribed:", sendCnt, act);
+  for (int s = 0; s < SUB_STREAM_CNT; s++)
+    if (subscribed[s])
+      printf(" %s", streams[s].name);
+  printf("\n");
+  if (bridge == NULL)
+    // simulated, nothing to measure
+    return;
+  for (int m = 0; m < MAX_MISSIONS; m++)
+  {
+    if (u[m].wall < 0.1)
+      continue;
+    float msgs = 0, bytes = 0, savedMsgs = 0, savedBytes = 0;
+    for (int s = 0; s < SUB_STREAM_CNT; s++)
+    {
+      float rate = u[m].msgs[s] / u[m].wall;
+      msgs += rate;
+      bytes += rate * streams[s].msgBytes;
+      savedMsgs += fmaxf(0, streams[s].defaultRate - rate);
+      savedBytes += fmaxf(0, streams[s].defaultRate - rate) * streams[s].msgBytes;
+    }
+    printf("#   mission %d: %.1f s, %.0f msg/s (%.1f kB/s), CPU %.1f%%, saved %.0f msg/s (%.1f kB/s)\n",
+           m, u[m].wall, msgs, bytes / 1000, u[m].cpu / u[m].wall * 100, savedMsgs, savedBytes / 1000);
+  }
+  printf("#   (saved is relative to all streams at nominal default rate)\n");
+}
@@ -0,0 +1,111 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef USUBSCRIPTIONS_H
+#define USUBSCRIPTIONS_H
+
+#include <mutex>
+#include "urun.h"
+#include "ubridge.h"
+
+/**
+ * Bridge data stream subscriptions for each mission.
+ * Each mission declares the streams it reads, streams needed by all
+ * missions (events, heartbeat, gamepad, safety) are declared once.
+ * A stream is subscribed (with UData::subscribe(), at the bridge default
+ * rate) when the first mission that needs it starts, streams no mission
+ * needs are never subscribed. The bridge has no way to change the rate of
+ * a stream or to stop it, so a subscribed stream stays subscribed.
+ * Received updates are counted per stream by a thread of its own (the
+ * bridge data time is tested every 1 ms), and with process CPU time
+ * reported per mission, together with the message rate and bandwidth saved
+ * compared to all streams at the default rate. */
+class USubscriptions : public URun
+{
+public:
+  /// stream id's
+  enum Stream {SUB_POSE, SUB_EDGE, SUB_MOTOR, SUB_EVENT, SUB_JOY, SUB_INFO, SUB_IRDIST, SUB_IMU, SUB_STREAM_CNT};
+  /// bridge name, default rate [Hz] (0 is on change) and message size [bytes] of a stream
+  struct StreamDef
+  {
+    const char *name;
+    float defaultRate;
+    int msgBytes;
+  };
+  static const StreamDef streams[SUB_STREAM_CNT];
+  /// missions with own subscriptions (0 is before the first mission, the always streams only)
+  const static int MAX_MISSIONS = 10;
+
+public:
+  /** Constructor
+   * \param reg is bridge, may be NULL when simulated (nothing to subscribe) */
+  USubscriptions(UBridge *reg);
+  /** destructor - stops counting */
+  ~USubscriptions();
+  /**
+   * Stream needed in all missions */
+  void always(int stream);
+  /**
+   * Stream needed in this mission (in addition to the always streams) */
+  void need(int mission, int stream);
+  /**
+   * Subscribe the streams needed by this mission, that are not subscribed
+   * already (missions above MAX_MISSIONS get all streams).
+   * Starts the update counting the first time. */
+  void setMission(int mission);
+  /** print subscriptions and measured usage */
+  void printStatus();
+  /**
+   * counting thread - detects updates of the subscribed streams */
+  void run();
+
+private:
+  /** subscribe stream at the bridge */
+  void subscribe(int stream);
+  /** time of latest update of a stream [sec] */
+  double updateTime(int stream);
+  /** process CPU time [sec] */
+  double cpuTime();
+  /** monotonic time [sec] */
+  double now();
+  //
+  UBridge *bridge;
+  /// stream needed per mission
+  bool needed[MAX_MISSIONS][SUB_STREAM_CNT];
+  bool alwaysNeeded[SUB_STREAM_CNT];
+  /// stream is subscribed
+  bool subscribed[SUB_STREAM_CNT];
+  /// usage while each mission is active
+  struct Usage
+  {
+    double wall = 0, cpu = 0;
+    long msgs[SUB_STREAM_CNT] = {0};
+  };
+  Usage usage[MAX_MISSIONS];
+  /// active mission and start of its current segment
+  int active = -1;
+  double segWall = 0, segCpu = 0;
+  int sendCnt = 0;
+  /// usage and active mission are updated by the mission and counting threads
+  mutex lock;
+};
+
+#endif
@@ -0,0 +1,399 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cstring>
+#include <cmath>
+#include <unistd.h>
+
+#include "utelemetry.h"
+#include "utime.h"
+
+const UTelemetry::StreamDef UTelemetry::streams[TM_STREAM_CNT] =
+{
+  {"pose",   100, 3, {"x", "y", "h"}},
+  {"edge",   100, 2, {"edgeLeft", "edgeRight"}},
+  {"motor",  100, 4, {"velLeft", "velRight", "currentLeft", "currentRight"}},
+  {"irdist", 100, 2, {"ir1", "ir2"}},
+  {"imu",    100, 6, {"accX", "accY", "accZ", "gyroX", "gyroY", "gyroZ"}},
+  {"joy",     10, 1, {"manual"}},
+  {"event",    0, 1, {"event"}},
+  {"info",     1, 1, {"regbotTime"}},
+};
+
+UTelemetry::UTelemetry(UBridge *reg)
+{
+  bridge = reg;
+  th1 = NULL;
+  th1stop = false;
+  filename[0] = '\0';
+  for (int i = 0; i < TM_STREAM_CNT; i++)
+  {
+    blockCnt[i] = 0;
+    samplesSaved[i] = 0;
+    samplesMissed[i] = 0;
+  }
+}
+
+UTelemetry::~UTelemetry()
+{
+  stop();
+}
+
+double UTelemetry::updateTime(int stream)
+{
+  switch (stream)
+  {
+  case TM_POSE: return bridge->pose->updTime.getDecSec();
+  case TM_EDGE: return bridge->edge->updTime.getDecSec();
+  case TM_MOTOR: return bridge->motor->updTime.getDecSec();
+  case TM_IRDIST: return bridge->irdist->updTime.getDecSec();
+  case TM_IMU: return bridge->imu->updTime.getDecSec();
+  case TM_JOY: return bridge->joy->updTime.getDecSec();
+  case TM_EVENT: return bridge->event->updTime.getDecSec();
+  case TM_INFO: return bridge->info->updTime.getDecSec();
+  default: return 0;
+  }
+}
+
+bool UTelemetry::getValues(int stream, float *v)
+{
+  switch (stream)
+  {
+  case TM_POSE:
+    v[0] = bridge->pose->x;
+    v[1] = bridge->pose->y;
+    v[2] = bridge->pose->h;
+    break;
+  case TM_EDGE:
+    v[0] = bridge->edge->edgeLeft;
+    v[1] = bridge->edge->edgeRight;
+    break;
+  case TM_MOTOR:
+    v[0] = bridge->motor->motorVel[0];
+    v[1] = bridge->motor->motorVel[1];
+    v[2] = bridge->motor->motorCurrent[0];
+    v[3] = bridge->motor->motorCurrent[1];
+    break;
+  case TM_IRDIST:
+    v[0] = bridge->irdist->dist[0];
+    v[1] = bridge->irdist->dist[1];
+    break;
+  case TM_IMU:
+    for (int i = 0; i < 3; i++)
+    {
+      v[i] = bridge->imu->acc[i];
+      v[i + 3] = bridge->imu->gyro[i];
+    }
+    break;
+  case TM_JOY:
+    v[0] = bridge->joy->manual;
+    break;
+  case TM_INFO:
+    v[0] = bridge->info->regbotTime;
+    break;
+  default:
+    // events are pushed by the mission
+    return false;
+  }
+  return true;
+}
+
+bool UTelemetry::start()
+{
+  if (logTm != NULL)
+    return true;
+  const int MNL = 100;
+  char date[MNL];
+  UTime t;
+  t.now();
+  t.getForFilename(date);
+  snprintf(filename, MNL, "telemetry_%s.bin", date);
+  logTm = fopen(filename, "w");
+  if (logTm == NULL)
+  {
+    printf("#UTelemetry:: Failed to open telemetry file %s\n", filename);
+    return false;
+  }
+  // schema header
+  fprintf(logTm, "robobot-telemetry 1\n");
+  for (int s = 0; s < TM_STREAM_CNT; s++)
+  {
+    fprintf(logTm, "stream %d %s %d", s, streams[s].name, streams[s].cols);
+    for (int c = 0; c < streams[s].cols; c++)
+      fprintf(logTm, " %s", streams[s].colNames[c]);
+    fprintf(logTm, "\n");
+  }
+  fprintf(logTm, "end\n");
+  // statistics are for this recording
+  for (int i = 0; i < TM_STREAM_CNT; i++)
+  {
+    blockCnt[i] = 0;
+    samplesSaved[i] = 0;
+    samplesMissed[i] = 0;
+  }
+  samplesLost = 0;
+  rereadCnt = 0;
+  pushCnt = 0;
+  startTime = t.getDecSec();
+  th1stop = false;
+  th1 = new thread(runObj, this);
+  thSampler = new std::thread(&UTelemetry::runSampler, this);
+  return true;
+}
+
+void UTelemetry::stop()
+{
+  th1stop = true;
+  if (thSampler != NULL)
+  {
+    thSampler->join();
+    delete thSampler;
+    thSampler = NULL;
+  }
+  if (th1 != NULL)
+  { // recorder saves the rest of the queue
+    th1->join();
+    delete th1;
+    th1 = NULL;
+  }
+  if (logTm != NULL)
+  {
+    fclose(logTm);
+    logTm = NULL;
+  }
+}
+
+void UTelemetry::push(int stream, double t, const float *v)
+{
+  Sample s;
+  s.t = t - startTime;
+  s.stream = stream;
+  memcpy(s.v, v, streams[stream].cols * sizeof(float));
+  if (not queue.push(s))
+    samplesLost++;
+  pushCnt++;
+}
+
+void UTelemetry::pushEvent(int event)
+{
+  if (logTm == NULL)
+    return;
+  Sample s;
+  s.t = updateTime(TM_EVENT) - startTime;
+  s.stream = TM_EVENT;
+  s.v[0] = event;
+  if (not eventQueue.push(s))
+    samplesLost++;
+}
+
+void UTelemetry::printStatus()
+{
+  printf("# ------- Telemetry recorder ----------\n");
+  printf("# recording=%d to '%s', queued=%d, lost=%d, read again=%d\n", logTm != NULL, filename,
+         queue.size() + eventQueue.size(), samplesLost.load(), rereadCnt);
+  printf("# saved");
+  for (int s = 0; s < TM_STREAM_CNT; s++)
+    printf(" %s=%d", streams[s].name, samplesSaved[s]);
+  printf("\n");
+  printf("# missed");
+  for (int s = 0; s < TM_STREAM_CNT; s++)
+    if (streams[s].rate > 0)
+      printf(" %s=%d", streams[s].name, samplesMissed[s]);
+  printf("\n");
+}
+
+/**
+ * Sampler thread.
+ * The bridge sets the update time of a data object for every message from
+ * the REGBOT, a changed update time is a new sample of that stream, stamped
+ * with the update time (also when the values are unchanged).
+ * The bridge thread may update the values while they are copied, so they are
+ * copied again if the update time has changed meanwhile.
+ * Runs at 1ms, two updates closer than that are seen as one, so the updates
+ * missing from the interval between samples (at the stream rate) are counted;
+ * a gap of 5 intervals or more is a pause in the stream, not missed updates. */
+void UTelemetry::runSampler()
+{
+  double last[TM_STREAM_CNT];
+  float v[MAX_COLS];
+  for (int s = 0; s < TM_STREAM_CNT; s++)
+    last[s] = updateTime(s);
+  while (not th1stop)
+  {
+    for (int s = 0; s < TM_STREAM_CNT; s++)
+    {
+      double t = updateTime(s);
+      if (t == last[s] or not getValues(s, v))
+        continue;
+      for (int i = 0; i < 3; i++)
+      {
+        double t2 = updateTime(s);
+        if (t2 == t)
+          break;
+        t = t2;
+        rereadCnt++;
+        getValues(s, v);
+      }
+      if (last[s] > 0)
+      {
+        int n = lround((t - last[s]) * streams[s].rate) - 1;
+        if (n > 0 and n < 5)
+          samplesMissed[s] += n;
+      }
+      last[s] = t;
+      push(s, t, v);
+    }
+    usleep(1000);
+  }
+}
+
+void UTelemetry::saveBlock(int s)
+{
+  uint8_t hdr[4];
+  uint16_t n = blockCnt[s];
+  hdr[0] = s;
+  hdr[1] = 0;
+  memcpy(&hdr[2], &n, 2);
+  fwrite(hdr, 1, 4, logTm);
+  fwrite(blockTime[s], sizeof(double), n, logTm);
+  for (int c = 0; c < streams[s].cols; c++)
+    fwrite(blockVal[s][c], sizeof(float), n, logTm);
+  samplesSaved[s] += n;
+  blockCnt[s] = 0;
+}
+
+void UTelemetry::addToBlock(const Sample &smp)
+{
+  int s = smp.stream;
+  int n = blockCnt[s];
+  blockTime[s][n] = smp.t;
+  for (int c = 0; c < streams[s].cols; c++)
+    blockVal[s][c][n] = smp.v[c];
+  blockCnt[s]++;
+  if (blockCnt[s] >= BLOCK_SIZE)
+    saveBlock(s);
+}
+
+/**
+ * Recorder thread, moves samples from queue to column blocks,
+ * and saves a block when full */
+void UTelemetry::run()
+{
+  Sample smp;
+  bool stopping = false;
+  while (not stopping)
+  { // empty the queue after stop is requested
+    stopping = th1stop;
+    while (queue.pop(smp))
+      addToBlock(smp);
+    while (eventQueue.pop(smp))
+      addToBlock(smp);
+    if (not stopping)
+      usleep(20000);
+  }
+  // save the rest
+  for (int s = 0; s < TM_STREAM_CNT; s++)
+    if (blockCnt[s] > 0)
+      saveBlock(s);
+  fflush(logTm);
+}
+
+int UTelemetry::exportCsv(const char *filename)
+{
+  FILE *fi = fopen(filename, "r");
+  if (fi == NULL)
+  {
+    printf("# UTelemetry::exportCsv: failed to open %s\n", filename);
+    return -1;
+  }
+  const int MSL = 300;
+  char s[MSL];
+  if (fgets(s, MSL, fi) == NULL or strncmp(s, "robobot-telemetry 1", 19) != 0)
+  {
+    printf("# UTelemetry::exportCsv: %s is not a telemetry file\n", filename);
+    fclose(fi);
+    return -1;
+  }
+  // read schema and open a CSV file for each stream
+  FILE *fo[TM_STREAM_CNT] = {NULL};
+  int cols[TM_STREAM_CNT] = {0};
+  char base[MSL];
+  strncpy(base, filename, MSL - 1);
+  base[MSL - 1] = '\0';
+  char *p = strrchr(base, '.');
+  if (p != NULL)
+    *p = '\0';
+  while (fgets(s, MSL, fi) != NULL and strncmp(s, "end", 3) != 0)
+  {
+    int id, n, pos;
+    char name[32];
+    if (sscanf(s, "stream %d %31s %d%n", &id, name, &n, &pos) == 3 and id >= 0 and id < TM_STREAM_CNT)
+    {
+      char fn[MSL + 40];
+      snprintf(fn, MSL + 40, "%s_%s.csv", base, name);
+      fo[id] = fopen(fn, "w");
+      cols[id] = n;
+      if (fo[id] != NULL)
+      { // column names from schema
+        char *names = &s[pos];
+        names[strcspn(names, "\n")] = '\0';
+        fprintf(fo[id], "time");
+        for (char *c = strtok(names, " "); c != NULL; c = strtok(NULL, " "))
+          fprintf(fo[id], ",%s", c);
+        fprintf(fo[id], "\n");
+      }
+    }
+  }
+  // convert blocks
+  int total = 0;
+  uint8_t hdr[4];
+  double t[BLOCK_SIZE];
+  float v[MAX_COLS][BLOCK_SIZE];
+  while (fread(hdr, 1, 4, fi) == 4)
+  {
+    uint16_t n;
+    memcpy(&n, &hdr[2], 2);
+    int id = hdr[0];
+    if (id >= TM_STREAM_CNT or n > BLOCK_SIZE or cols[id] > MAX_COLS)
+      break;
+    bool isOK = fread(t, sizeof(double), n, fi) == n;
+    for (int c = 0; c < cols[id] and isOK; c++)
+      isOK = fread(v[c], sizeof(float), n, fi) == n;
+    if (not isOK)
+      // truncated file (recording not stopped)
+      break;
+    if (fo[id] != NULL)
+    {
+      for (int i = 0; i < n; i++)
+      {
+        fprintf(fo[id], "%.4f", t[i]);
+        for (int c = 0; c < cols[id]; c++)
+          fprintf(fo[id], ",%g", v[c][i]);
+        fprintf(fo[id], "\n");
+      }
+    }
+    total += n;
+  }
+  for (int i = 0; i < TM_STREAM_CNT; i++)
+    if (fo[i] != NULL)
+      fclose(fo[i]);
+  fclose(fi);
+  return total;
+}
@@ -0,0 +1,198 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UTELEMETRY_H
+#define UTELEMETRY_H
+
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include "urun.h"
+#include "ubridge.h"
+
+/**
+ * Lock-free single producer, single consumer queue.
+ * One thread may call push() and one (other) thread may call pop().
+ * N must be a power of 2. */
+template <typename T, int N>
+class USpscQueue
+{
+public:
+  /**
+   * add an element
+   * \returns false if the queue is full (element is not added) */
+  bool push(const T &v)
+  {
+    const uint32_t h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) >= uint32_t(N))
+      return false;
+    buf[h & (N - 1)] = v;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+  /**
+   * get oldest element
+   * \returns false if the queue is empty */
+  bool pop(T &v)
+  {
+    const uint32_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire))
+      return false;
+    v = buf[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  /// number of elements in queue (approximate, when the other side is active)
+  int size()
+  {
+    return int(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+  }
+
+private:
+  static_assert((N & (N - 1)) == 0, "USpscQueue size must be a power of 2");
+  T buf[N];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+};
+
+/**
+ * Record of all updates on the subscribed bridge data streams.
+ * A sampler (producer) thread detects updates of the bridge data (by the
+ * update time of each data object) and hands the samples over a lock-free queue to the recorder thread,
+ * that saves them in a columnar binary file.
+ * Events are cleared when read, so they are recorded by the mission (when taken)
+ * over a second lock-free queue, stamped with the update time of the bridge event data.
+ * Updates that arrive faster than the sampler polls are lost, these are
+ * counted as missed from the interval between samples and the stream rate.
+ *
+ * File format:
+ *   text header: "robobot-telemetry 1\n", then one line per stream
+ *   "stream <id> <name> <columns> <column names ...>\n" and "end\n".
+ *   Then binary blocks: uint8 stream id, uint8 0, uint16 n (samples),
+ *   n doubles (bridge update time in seconds since start) followed by n floats
+ *   for each of the stream columns (so column by column).
+ * Use telemetry2csv to convert to one CSV file per stream. */
+class UTelemetry : public URun
+{
+public:
+  /// stream id's
+  enum Stream {TM_POSE, TM_EDGE, TM_MOTOR, TM_IRDIST, TM_IMU, TM_JOY, TM_EVENT, TM_INFO, TM_STREAM_CNT};
+  /// max values in one sample
+  const static int MAX_COLS = 6;
+  /// samples in one saved block
+  const static int BLOCK_SIZE = 256;
+  /// one sample of one stream
+  struct Sample
+  {
+    double t;
+    uint8_t stream;
+    float v[MAX_COLS];
+  };
+  /// description of the streams (name, bridge default rate [Hz] (0 is on change), column count and column names)
+  struct StreamDef
+  {
+    const char *name;
+    float rate;
+    int cols;
+    const char *colNames[MAX_COLS];
+  };
+  static const StreamDef streams[TM_STREAM_CNT];
+
+public:
+  /** Constructor */
+  UTelemetry(UBridge *reg);
+  /** destructor - stops recording */
+  ~UTelemetry();
+  /**
+   * Start recording to a new file named telemetry_[date].bin
+   * \returns true if file is opened */
+  bool start();
+  /**
+   * stop recording, flush and close file */
+  void stop();
+  /**
+   * Add a sample - may be called by the one producer only (sampler thread or bridge).
+   * \param stream is the stream id
+   * \param t is the bridge update time of the values [sec since epoch]
+   * \param v is the values (as many as columns in the stream)
+   * Never blocks - if queue is full, the sample is counted as lost. */
+  void push(int stream, double t, const float *v);
+  /**
+   * Add an event taken by the mission - may be called by the mission thread only.
+   * \param event is the event number
+   * Never blocks - if queue is full, the event is counted as lost. */
+  void pushEvent(int event);
+  /**
+   * print recorder status */
+  void printStatus();
+  /**
+   * recorder thread - saves samples to file */
+  void run();
+  /**
+   * Convert a telemetry file to CSV files, one per stream,
+   * named [filename without .bin]_[stream].csv
+   * \returns number of samples converted, or -1 if file is not valid */
+  static int exportCsv(const char *filename);
+  /// is recording
+  bool isRecording()
+  {
+    return logTm != NULL;
+  }
+
+private:
+  /**
+   * sampler thread, tests bridge data for updates */
+  void runSampler();
+  /** save one block of samples for one stream */
+  void saveBlock(int stream);
+  /** add a sample to the block of its stream, save the block when full */
+  void addToBlock(const Sample &smp);
+  /** bridge update time of a stream [sec since epoch] */
+  double updateTime(int stream);
+  /**
+   * copy the current values of a stream
+   * \returns false if the stream is not sampled (event) */
+  bool getValues(int stream, float *v);
+  //
+  UBridge *bridge;
+  FILE *logTm = NULL;
+  USpscQueue<Sample, 8192> queue;
+  /// events from the mission thread
+  USpscQueue<Sample, 256> eventQueue;
+  /// samples waiting to be saved - column format
+  double blockTime[TM_STREAM_CNT][BLOCK_SIZE];
+  float blockVal[TM_STREAM_CNT][MAX_COLS][BLOCK_SIZE];
+  int blockCnt[TM_STREAM_CNT];
+  /// sampler thread
+  std::thread *thSampler = NULL;
+  /// recording start [sec since epoch], saved times are relative to this
+  double startTime = 0;
+  /// statistics
+  std::atomic<int> samplesLost{0};
+  int samplesSaved[TM_STREAM_CNT];
+  /// updates not seen by the sampler (estimated) and values read again as they changed while copied
+  int samplesMissed[TM_STREAM_CNT];
+  int rereadCnt = 0;
+  int pushCnt = 0;
+  char filename[100];
+};
+
+#endif
@@ -0,0 +1,268 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <time.h>
+#include "utraffic.h"
+
+static const char *typeNames[UTraffic::TR_TYPE_CNT] = {"cmd", "status", "event", "pose", "ir", "vel"};
+
+UTraffic::~UTraffic()
+{
+  stop();
+}
+
+double UTraffic::now()
+{
+  if (clock != NULL)
+    return *clock;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9 - startTime;
+}
+
+int UTraffic::valueCnt(int type)
+{
+  switch (type)
+  {
+  case TR_POSE: return 3;
+  case TR_IR: return 2;
+  case TR_VEL: return 1;
+  default: return 0;
+  }
+}
+
+bool UTraffic::start(const char *filename, const double *simClock)
+{
+  lock_guard<mutex> guard(lock);
+  if (log != NULL)
+    return true;
+  log = fopen(filename, "w");
+  if (log == NULL)
+  {
+    printf("# UTraffic:: failed to open traffic trace %s\n", filename);
+    return false;
+  }
+  fprintf(log, "robobot-traffic 1\n");
+  for (int i = 0; i < TR_TYPE_CNT; i++)
+    fprintf(log, "record %d %s\n", i, typeNames[i]);
+  fprintf(log, "end\n");
+  clock = NULL;
+  startTime = 0;
+  startTime = now();
+  clock = simClock;
+  return true;
+}
+
+void UTraffic::stop()
+{
+  lock_guard<mutex> guard(lock);
+  if (log != NULL)
+  {
+    fclose(log);
+    log = NULL;
+  }
+}
+
+void UTraffic::save(int type, int arg, const void *data, int n)
+{ // lock is held
+  double t = now();
+  uint8_t hdr[4] = {uint8_t(type), uint8_t(arg), uint8_t(n & 0xff), uint8_t(n >> 8)};
+  fwrite(&t, sizeof(t), 1, log);
+  fwrite(hdr, 1, 4, log);
+  if (n > 0)
+    fwrite(data, 1, n, log);
+  bytes += sizeof(t) + 4 + n;
+  recCnt[type]++;
+}
+
+void UTraffic::command(const char *cmd, bool status)
+{
+  lock_guard<mutex> guard(lock);
+  if (log != NULL)
+    save(status ? TR_STATUS : TR_CMD, 0, cmd, std::min((int)strlen(cmd), 0xffff));
+}
+
+void UTraffic::event(int event)
+{
+  lock_guard<mutex> guard(lock);
+  if (log != NULL)
+    save(TR_EVENT, event, NULL, 0);
+}
+
+void UTraffic::values(int type, const float *v)
+{
+  int n = valueCnt(type);
+  lock_guard<mutex> guard(lock);
+  if (log == NULL or n == 0)
+    return;
+  if (lastValid[type] and memcmp(last[type], v, n * sizeof(float)) == 0)
+    return;
+  memcpy(last[type], v, n * sizeof(float));
+  lastValid[type] = true;
+  save(type, 0, v, n * sizeof(float));
+}
+
+int UTraffic::load(const char *filename)
+{
+  FILE *fi = fopen(filename, "r");
+  if (fi == NULL)
+  {
+    printf("# UTraffic:: failed to open %s\n", filename);
+    return -1;
+  }
+  const int MSL = 100;
+  char s[MSL];
+  if (fgets(s, MSL, fi) == NULL or strncmp(s, "robobot-traffic 1", 17) != 0)
+  {
+    printf("# UTraffic:: %s is not a traffic trace\n", filename);
+    fclose(fi);
+    return -1;
+  }
+  while (fgets(s, MSL, fi) != NULL and strncmp(s, "end", 3) != 0)
+    ;
+  recs.clear();
+  double t;
+  uint8_t hdr[4];
+  char buf[0x10000];
+  while (fread(&t, sizeof(t), 1, fi) == 1 and fread(hdr, 1, 4, fi) == 4)
+  {
+    int n = hdr[2] + (hdr[3] << 8);
+    if (hdr[0] >= TR_TYPE_CNT or (n > 0 and (int)fread(buf, 1, n, fi) != n))
+    {
+      printf("# UTraffic:: %s is truncated after %d records\n", filename, (int)recs.size());
+      break;
+    }
+    Record r;
+    r.t = t;
+    r.type = hdr[0];
+    r.arg = hdr[1];
+    if (r.type == TR_CMD or r.type == TR_STATUS)
+      r.text.assign(buf, n);
+    else
+      memcpy(r.v, buf, std::min(n, (int)sizeof(r.v)));
+    recs.push_back(r);
+  }
+  fclose(fi);
+  loaded = true;
+  nextIn = 0;
+  nextCmd = 0;
+  matchCnt = 0;
+  diffCnt = 0;
+  extraCnt = 0;
+  dtSum = 0;
+  dtMax = 0;
+  dtMaxCmd = -1;
+  return recs.size();
+}
+
+bool UTraffic::nextInput(double t, Record &rec)
+{
+  while (nextIn < (int)recs.size())
+  {
+    const Record &r = recs[nextIn];
+    if (r.type == TR_CMD or r.type == TR_STATUS)
+    { // commands are compared, not fed
+      nextIn++;
+      continue;
+    }
+    if (r.t > t)
+      return false;
+    rec = r;
+    nextIn++;
+    return true;
+  }
+  return false;
+}
+
+void UTraffic::compare(const char *cmd, double t)
+{
+  while (nextCmd < (int)recs.size() and recs[nextCmd].type != TR_CMD)
+    nextCmd++;
+  if (nextCmd >= (int)recs.size())
+  {
+    if (extraCnt++ < maxReport)
+      printf("# replay %.3f: extra command '%s'\n", t, cmd);
+    return;
+  }
+  const Record &r = recs[nextCmd];
+  if (r.text == cmd)
+  {
+    double dt = t - r.t;
+    matchCnt++;
+    dtSum += fabs(dt);
+    if (fabs(dt) > fabs(dtMax))
+    {
+      dtMax = dt;
+      dtMaxCmd = nextCmd;
+    }
+  }
+  else if (diffCnt++ < maxReport)
+  { // text without new-line
+    int n = strcspn(cmd, "\n");
+    int m = strcspn(r.text.c_str(), "\n");
+    printf("# replay %.3f: command differs, recorded at %.3f '%.*s', now '%.*s'\n",
+           t, r.t, m, r.text.c_str(), n, cmd);
+  }
+  nextCmd++;
+}
+
+int UTraffic::missingCnt()
+{
+  int missing = 0;
+  for (int i = nextCmd; i < (int)recs.size(); i++)
+    if (recs[i].type == TR_CMD)
+      missing++;
+  return missing;
+}
+
+bool UTraffic::replayOK()
+{
+  return loaded and diffCnt == 0 and extraCnt == 0 and missingCnt() == 0;
+}
+
+void UTraffic::printStatus()
+{
+  printf("# ------- Traffic trace ----------\n");
+  if (loaded)
+  {
+    int missing = missingCnt();
+    printf("# replay of %d records: %d commands identical, %d differ, %d missing, %d extra\n",
+           (int)recs.size(), matchCnt, diffCnt, missing, extraCnt);
+    if (matchCnt > 0)
+      printf("#   timing difference: mean %.1f ms, max %.1f ms\n", dtSum / matchCnt * 1000, dtMax * 1000);
+    if (dtMaxCmd >= 0)
+    { // command without new-line
+      const Record &r = recs[dtMaxCmd];
+      printf("#   largest difference for '%.*s' recorded at %.3f s\n",
+             (int)strcspn(r.text.c_str(), "\n"), r.text.c_str(), r.t);
+    }
+  }
+  else
+  {
+    printf("# recording=%d, %.1f kB:", log != NULL, bytes / 1000.0);
+    for (int i = 0; i < TR_TYPE_CNT; i++)
+      printf(" %s=%d", typeNames[i], recCnt[i]);
+    printf("\n");
+  }
+}
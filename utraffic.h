@@ -0,0 +1,146 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef UTRAFFIC_H
+#define UTRAFFIC_H
+
+#include <cstdio>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+/**
+ * Trace of the traffic between the mission and the bridge (or simulator).
+ * Recording: every command send by the command channel (mission
+ * commands and display status), every event seen by the mission, and the
+ * pose, IR distance and velocity inputs (when changed) are saved with a
+ * monotonic time stamp (simulated time when running against USim).
+ *
+ * Replay: the trace is loaded and fed back to the mission through the
+ * simulator (USim replay mode): inputs are given to the mission at their
+ * recorded time, and each mission command is compared with the recorded
+ * command in sequence. The report lists differing commands and the timing
+ * difference of the matching commands.
+ *
+ * File format:
+ *   text header: "robobot-traffic 1\n", then one line per record type
+ *   "record <type> <name>\n" and "end\n".
+ *   Then binary records: double time [sec since start], uint8 type,
+ *   uint8 arg (event number), uint16 n (payload bytes) and n bytes payload,
+ *   that is the command text (no terminator) or floats. */
+class UTraffic
+{
+public:
+  /// record types
+  enum RecType {TR_CMD, TR_STATUS, TR_EVENT, TR_POSE, TR_IR, TR_VEL, TR_TYPE_CNT};
+  /// one record (when loaded for replay)
+  struct Record
+  {
+    double t;
+    int type;
+    int arg;
+    float v[3];
+    string text;
+  };
+  /// differing commands printed during replay
+  int maxReport = 10;
+
+public:
+  /** destructor - closes file */
+  ~UTraffic();
+  /**
+   * Start recording to this file
+   * \param simClock is the time source, if NULL the monotonic clock is used
+   * \returns true if file is opened */
+  bool start(const char *filename, const double *simClock = NULL);
+  /** stop recording */
+  void stop();
+  bool isRecording()
+  {
+    return log != NULL;
+  }
+  /**
+   * A command is send
+   * \param status is true for display (O-led) status */
+  void command(const char *cmd, bool status);
+  /** an event is seen by the mission */
+  void event(int event);
+  /**
+   * Input values (saved if changed since last record of this type)
+   * \param type is TR_POSE (x,y,h), TR_IR (ir1, ir2) or TR_VEL (velocity) */
+  void values(int type, const float *v);
+  /**
+   * Load a trace for replay
+   * \returns number of records, or -1 if not a valid file */
+  int load(const char *filename);
+  /**
+   * Next input record (event, pose, ir or velocity) at or before time t
+   * \returns false if no more inputs before t */
+  bool nextInput(double t, Record &rec);
+  /**
+   * Compare a mission command in replay with the next recorded command
+   * \param t is the replay time */
+  void compare(const char *cmd, double t);
+  /** all recorded inputs are replayed */
+  bool replayEnded()
+  {
+    return loaded and nextIn >= (int)recs.size();
+  }
+  /**
+   * Replay result
+   * \returns true if all recorded commands are send again, and no other */
+  bool replayOK();
+  /** print recording or replay status */
+  void printStatus();
+
+private:
+  /** recorded commands not (yet) send in replay */
+  int missingCnt();
+  /** values in a record type */
+  int valueCnt(int type);
+  /** save one record */
+  void save(int type, int arg, const void *data, int n);
+  /// time now [sec since start]
+  double now();
+  //
+  mutex lock;
+  FILE *log = NULL;
+  const double *clock = NULL;
+  double startTime = 0;
+  /// last saved values of pose, ir and velocity
+  float last[TR_TYPE_CNT][3];
+  bool lastValid[TR_TYPE_CNT] = {false};
+  int recCnt[TR_TYPE_CNT] = {0};
+  long bytes = 0;
+  /// replay
+  bool loaded = false;
+  vector<Record> recs;
+  /// index of next input record, and next command record
+  int nextIn = 0, nextCmd = 0;
+  int matchCnt = 0, diffCnt = 0, extraCnt = 0;
+  double dtSum = 0, dtMax = 0;
+  int dtMaxCmd = -1;
+};
+
+#endif
@@ -0,0 +1,151 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include "utrajectory.h"
+
+void UTrajectory::clear()
+{
+  segs.clear();
+}
+
+void UTrajectory::straight(float v, const char *cond, const char *assign)
+{
+  Segment s;
+  s.type = SEG_STRAIGHT;
+  s.v = v != 0 ? v : vel;
+  s.radius = 0;
+  s.angle = 0;
+  s.cond = cond;
+  if (assign != NULL)
+    s.assign = assign;
+  segs.push_back(s);
+}
+
+void UTrajectory::arc(float angle, float radius)
+{
+  Segment s;
+  s.type = SEG_ARC;
+  s.radius = fmaxf(radius, 0.02);
+  // lateral acceleration is v^2/r
+  s.v = fminf(vel, sqrtf(latAcc * s.radius));
+  s.angle = angle;
+  segs.push_back(s);
+}
+
+void UTrajectory::spin(float angle)
+{
+  Segment s;
+  s.type = SEG_SPIN;
+  s.v = spinVel;
+  s.radius = 0;
+  s.angle = angle;
+  segs.push_back(s);
+}
+
+void UTrajectory::stop(const char *assign)
+{
+  Segment s;
+  s.type = SEG_STOP;
+  s.v = 0;
+  s.radius = 0;
+  s.angle = 0;
+  if (assign != NULL)
+    s.assign = assign;
+  segs.push_back(s);
+}
+
+float UTrajectory::turnLead(const Segment &s)
+{ // turn rate
+  float w;
+  if (s.type == SEG_SPIN)
+    w = 2 * s.v / wheelBase;
+  else
+    w = s.v / s.radius;
+  // the wheel speed difference (w * wheelBase) is removed with
+  // acc on both wheels, the rate decreases linearly to zero
+  float t = w * wheelBase / (2 * acc);
+  return w * t / 2 * 180 / M_PI;
+}
+
+int UTrajectory::make(char **lines, int maxLines, int maxLen)
+{
+  int line = 0;
+  for (int i = 0; i < (int)segs.size(); i++)
+  {
+    if (line >= maxLines)
+    {
+      printf("# UTrajectory::make: more than %d lines, manoeuvre is truncated\n", maxLines);
+      break;
+    }
+    const Segment &s = segs[i];
+    const char *sep = s.assign.empty() ? "" : ", ";
+    switch (s.type)
+    {
+    case SEG_STRAIGHT:
+      snprintf(lines[line++], maxLen, "vel=%.3f, acc=%.1f%s%s: %s",
+               s.v, acc, sep, s.assign.c_str(), s.cond.c_str());
+      break;
+    case SEG_ARC:
+    case SEG_SPIN:
+    {
+      float lead = fminf(turnLead(s), fabsf(s.angle) / 2);
+      snprintf(lines[line++], maxLen, "vel=%.3f, tr=%.3f, acc=%.1f: turn=%.1f",
+               s.v, s.radius, acc, copysignf(fabsf(s.angle) - lead, s.angle));
+      break;
+    }
+    case SEG_STOP:
+      snprintf(lines[line++], maxLen, "vel=0%s%s: time=0.1", sep, s.assign.c_str());
+      break;
+    }
+  }
+  return line;
+}
+
+float UTrajectory::duration()
+{
+  float t = 0;
+  for (auto &s : segs)
+  {
+    float d = 0;
+    if (s.type == SEG_ARC)
+      d = fabsf(s.angle) * M_PI / 180 * s.radius;
+    else if (s.type == SEG_SPIN)
+      d = fabsf(s.angle) * M_PI / 180 * wheelBase / 2;
+    else if (s.type == SEG_STRAIGHT and s.cond.compare(0, 5, "dist=") == 0)
+      d = strtof(s.cond.c_str() + 5, NULL);
+    if (fabsf(s.v) > 0.01)
+      t += d / fabsf(s.v);
+  }
+  return t;
+}
+
+void UTrajectory::printStatus()
+{
+  const char *names[] = {"straight", "arc", "spin", "stop"};
+  printf("# trajectory: %d segments, known part takes %.1f s (vel=%.2f, acc=%.1f, latAcc=%.2f)\n",
+         (int)segs.size(), duration(), vel, acc, latAcc);
+  for (auto &s : segs)
+    printf("#   %-8s v=%.2f r=%.2f angle=%.0f %s %s\n",
+           names[s.type], s.v, s.radius, s.angle, s.cond.c_str(), s.assign.c_str());
+}
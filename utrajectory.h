@@ -0,0 +1,116 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+
+#ifndef UTRAJECTORY_H
+#define UTRAJECTORY_H
+
+#include <cstdio>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+/**
+ * Trajectory of continuous segments, made into a REGBOT snippet.
+ * A manoeuvre is a list of straight segments (ended by a distance or a sensor
+ * condition), arcs (turn radius tr > 0) and turns on the spot (tr = 0).
+ * Segments follow each other without the intermediate stops and correction
+ * turns of hand-written snippets:
+ * the velocity in an arc is limited by the lateral acceleration,
+ * and a turn is ended a bit early, so that the heading
+ * overshoot while the wheel speeds settle (acceleration limited) gives the
+ * wanted angle. */
+class UTrajectory
+{
+public:
+  /// straight segment velocity [m/s]
+  float vel = 0.3;
+  /// wheel velocity in turns on the spot [m/s]
+  float spinVel = 0.2;
+  /// acceleration limit (acc=) [m/s^2]
+  float acc = 2;
+  /// lateral acceleration limit in arcs [m/s^2]
+  float latAcc = 0.5;
+  /// distance between the wheels [m]
+  float wheelBase = 0.16;
+
+public:
+  /** remove all segments */
+  void clear();
+  /**
+   * Drive straight at velocity
+   * \param v is velocity (negative is reverse), 0 is the default vel
+   * \param cond is end condition, e.g. "dist=0.2" or "ir1>0.5"
+   * \param assign is extra assignments for this line, e.g. "event=3" or NULL */
+  void straight(float v, const char *cond, const char *assign = NULL);
+  /**
+   * Drive a distance straight at the default velocity */
+  void straight(float dist)
+  {
+    char s[32];
+    snprintf(s, 32, "dist=%.3f", dist);
+    straight(0, s);
+  }
+  /**
+   * Turn an angle in an arc
+   * \param angle is turn angle in degrees (positive is left)
+   * \param radius is turn radius [m] */
+  void arc(float angle, float radius);
+  /**
+   * Turn an angle on the spot
+   * \param angle in degrees (positive is left) */
+  void spin(float angle);
+  /**
+   * End of the manoeuvre: stop (after a short time, to let the last
+   * turn settle), with extra assignments, e.g. "event=1" */
+  void stop(const char *assign = NULL);
+  /**
+   * Make the snippet lines
+   * \param lines is line buffers of maxLen characters
+   * \param maxLines is number of line buffers
+   * \returns number of lines used */
+  int make(char **lines, int maxLines, int maxLen);
+  /** estimated time for the known (distance and angle) part [sec] */
+  float duration();
+  /** print segments */
+  void printStatus();
+
+private:
+  enum SegType {SEG_STRAIGHT, SEG_ARC, SEG_SPIN, SEG_STOP};
+  struct Segment
+  {
+    SegType type;
+    /// velocity [m/s]
+    float v;
+    /// turn radius [m] and angle [deg]
+    float radius;
+    float angle;
+    string cond;
+    string assign;
+  };
+  /** heading change [deg] after the turn condition is met, while
+   * the wheel speeds settle to the next segment */
+  float turnLead(const Segment &s);
+  //
+  vector<Segment> segs;
+};
+
+#endif
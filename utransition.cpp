@@ -0,0 +1,151 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cmath>
+#include "utransition.h"
+
+void UTransitionStats::decision(double t)
+{
+  tDecision = t;
+  tUpStart = t;
+  tUpEnd = t;
+  inDecision = true;
+}
+
+void UTransitionStats::uploadStart(double t)
+{ // a preload outside a decision is not on the critical path
+  if (inDecision)
+    tUpStart = t;
+}
+
+void UTransitionStats::uploadEnd(double t)
+{
+  if (inDecision)
+    tUpEnd = t;
+}
+
+void UTransitionStats::activated(double t, int mission, int state, float x, float y, float h)
+{
+  if (pending)
+    // last activation had no motion
+    finish(-1);
+  if (not inDecision)
+  { // activation of a preloaded snippet
+    tDecision = t;
+    tUpStart = t;
+    tUpEnd = t;
+  }
+  inDecision = false;
+  tActive = t;
+  pending = true;
+  pendingMission = mission;
+  pendingState = state;
+  pose[0] = x;
+  pose[1] = y;
+  pose[2] = h;
+}
+
+void UTransitionStats::testMotion(double t, float x, float y, float h)
+{
+  if (pending)
+  { // moved more than 2mm or 0.5 degree
+    if (hypot(x - pose[0], y - pose[1]) > 0.002 or fabs(h - pose[2]) > 0.5 * M_PI / 180)
+      finish(t);
+  }
+}
+
+void UTransitionStats::finish(double tMotion)
+{
+  double tE = tEvent >= tLoop ? tEvent : tLoop;
+  double dt[PH_CNT];
+  dt[PH_DECIDE] = fmax(0, tDecision - tE);
+  dt[PH_UPLOAD] = tUpEnd - tUpStart;
+  dt[PH_SETTLE] = tActive - tUpEnd;
+  if (tMotion > 0)
+  {
+    dt[PH_MOTION] = tMotion - tActive;
+    dt[PH_TOTAL] = tMotion - tE;
+  }
+  else
+  { // no motion (e.g. a stop snippet)
+    dt[PH_MOTION] = 0;
+    dt[PH_TOTAL] = tActive - tE;
+  }
+  // log2 histogram of total in ms
+  int bin = 0;
+  for (double ms = 1.0; bin < BIN_CNT - 1 and dt[PH_TOTAL] * 1000 >= ms; ms *= 2)
+    bin++;
+  {
+    std::lock_guard<std::mutex> guard(statsLock);
+    Stat &st = stats[pendingMission * 1000 + pendingState];
+    st.cnt++;
+    for (int i = 0; i < PH_CNT; i++)
+    {
+      st.sum[i] += dt[i];
+      if (dt[i] > st.max[i])
+        st.max[i] = dt[i];
+    }
+    st.hist[bin]++;
+  }
+  if (logTr != NULL)
+  {
+    fprintf(logTr, "%.3f %d %d %d %.2f %.2f %.2f %.2f %.2f\n",
+            tActive, pendingMission, pendingState, tMotion > 0,
+            dt[PH_DECIDE] * 1000, dt[PH_UPLOAD] * 1000, dt[PH_SETTLE] * 1000,
+            dt[PH_MOTION] * 1000, dt[PH_TOTAL] * 1000);
+    fflush(logTr);
+  }
+  pending = false;
+}
+
+void UTransitionStats::logHeader()
+{
+  if (logTr != NULL)
+  {
+    fprintf(logTr, "%% 1  Time of activation [sec]\n");
+    fprintf(logTr, "%% 2  mission number.\n");
+    fprintf(logTr, "%% 3  mission state (that made the transition).\n");
+    fprintf(logTr, "%% 4  motion detected (0 = no motion before next transition).\n");
+    fprintf(logTr, "%% 5  decide: event observed to decision [ms]\n");
+    fprintf(logTr, "%% 6  upload: snippet send (0 if preloaded) [ms]\n");
+    fprintf(logTr, "%% 7  settle: upload end to activation sent [ms]\n");
+    fprintf(logTr, "%% 8  motion: activation to first pose change [ms]\n");
+    fprintf(logTr, "%% 9  total: event observed to first pose change [ms]\n");
+  }
+}
+
+void UTransitionStats::printStatus(FILE *fo, char lead)
+{
+  std::lock_guard<std::mutex> guard(statsLock);
+  fprintf(fo, "%c transitions (average/max in ms)     decide       upload       settle       motion        total\n", lead);
+  for (auto &s : stats)
+  {
+    Stat &st = s.second;
+    fprintf(fo, "%c   mission %d state %3d (n=%3d)", lead, s.first / 1000, s.first % 1000, st.cnt);
+    for (int i = 0; i < PH_CNT; i++)
+      fprintf(fo, " %5.1f/%6.1f", st.sum[i] / st.cnt * 1000, st.max[i] * 1000);
+    fprintf(fo, "\n");
+    fprintf(fo, "%c     total histogram <1ms:%d", lead, st.hist[0]);
+    int ms = 1;
+    for (int b = 1; b < BIN_CNT - 1; b++, ms *= 2)
+      fprintf(fo, " <%d:%d", ms * 2, st.hist[b]);
+    fprintf(fo, " >=%d:%d\n", ms, st.hist[BIN_CNT - 1]);
+  }
+}
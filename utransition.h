@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UTRANSITION_H
+#define UTRANSITION_H
+
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+/**
+ * Timing of mission state transitions.
+ * For every snippet activation the time is split in phases:
+ *   decide  - from event observed (or start of the mission loop pass) to the decision (snippet send is called)
+ *   upload  - sending the snippet lines (0 if the snippet was preloaded)
+ *   settle  - from upload end (or decision) to the activation event is sent
+ *   motion  - from activation to first pose change (resolution is the mission loop period)
+ *   total   - from event observed to first pose change
+ * Statistics are kept for each mission and state (the state that made the decision).
+ * Statistics are updated by the mission thread and printed by the console,
+ * so they are guarded by a lock.
+ * All times are in seconds. */
+class UTransitionStats
+{
+public:
+  enum Phase {PH_DECIDE, PH_UPLOAD, PH_SETTLE, PH_MOTION, PH_TOTAL, PH_CNT};
+  /// histogram bins: <1ms, <2ms, <4ms ... <512ms, >= 512ms
+  const static int BIN_CNT = 11;
+  /// logfile for transitions (opened by mission)
+  FILE *logTr = NULL;
+
+public:
+  /** start of a mission loop pass */
+  void loopStart(double t)
+  {
+    tLoop = t;
+  }
+  /** an event is observed by the mission */
+  void eventSeen(double t)
+  {
+    tEvent = t;
+  }
+  /** a snippet is to be send and activated (decision made) */
+  void decision(double t);
+  /** snippet upload start and end */
+  void uploadStart(double t);
+  void uploadEnd(double t);
+  /**
+   * snippet activation event is send.
+   * \param mission and state is the mission state that decided the transition
+   * \param x,y,h is the robot pose at activation */
+  void activated(double t, int mission, int state, float x, float y, float h);
+  /**
+   * Test for first motion after an activation (to be called every mission loop pass)
+   * \param x,y,h is current robot pose */
+  void testMotion(double t, float x, float y, float h);
+  /**
+   * print statistics
+   * \param fo is the file to print to (e.g. the mission log)
+   * \param lead is the first character of each line ('#' on console, '%' in logfiles) */
+  void printStatus(FILE *fo = stdout, char lead = '#');
+  /** write column description to transition log */
+  void logHeader();
+
+private:
+  struct Stat
+  {
+    int cnt = 0;
+    double sum[PH_CNT] = {0};
+    double max[PH_CNT] = {0};
+    int hist[BIN_CNT] = {0};
+  };
+  /** save the pending transition to statistics and log */
+  void finish(double tMotion);
+  //
+  std::map<int, Stat> stats;
+  std::mutex statsLock;
+  double tLoop = 0, tEvent = 0, tDecision = 0, tUpStart = 0, tUpEnd = 0, tActive = 0;
+  bool inDecision = false;
+  bool pending = false;
+  int pendingMission = 0, pendingState = 0;
+  float pose[3] = {0};
+};
+
+#endif
@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UVISIONJOB_H
+#define UVISIONJOB_H
+
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include "utime.h"
+#include "uobjectdetect.h"
+#include "uarucotrack.h"
+
+/**
+ * Vision jobs that can be submitted to the camera thread */
+enum UVisionJobType {VJ_BALL, VJ_ARUCO, VJ_SAVE, VJ_OBJECTS};
+
+/**
+ * Options for a vision job */
+struct UVisionOptions
+{
+  /// job is dropped if no frame is processed within this time [sec], 0 is no deadline
+  float deadline = 0;
+  /// save image (and ball mask) to disk as part of the job
+  bool saveImage = false;
+  /// name used in filename for saved images (NULL is 'ucamera')
+  const char *name = NULL;
+};
+
+/**
+ * Result of a vision job, delivered through the future in UVisionJob */
+struct UVisionResult
+{
+  enum Status {DONE, CANCELLED, EXPIRED, QUEUE_FULL, NO_CAMERA};
+  Status status = DONE;
+  /// ball detection: found, distance [mm] and angle [degrees, positive is left]
+  bool found = false;
+  float distance = 0;
+  float angle = 0;
+  /// object detection: all objects found (for all object models)
+  std::vector<UDetection> objects;
+  /// ArUco detection (tracker mode only): markers found
+  std::vector<UArUcoMarker> markers;
+  /// result is reused from an earlier frame (scene and pose unchanged)
+  bool cached = false;
+  /// frame number and time the image was taken
+  int frame = 0;
+  UTime imTime;
+  /// time from submit until the image was taken, and processing time [sec]
+  float waitTime = 0;
+  float processTime = 0;
+  /** true if job was processed */
+  bool isOK()
+  {
+    return status == DONE;
+  }
+};
+
+/**
+ * A submitted vision job. The submitter keeps a shared pointer, and
+ * can poll, wait for or cancel the job. The camera thread fulfils the promise.
+ * A job is processed on the first frame taken after it was submitted. */
+class UVisionJob
+{
+public:
+  UVisionJobType type;
+  UVisionOptions options;
+  /// result, available when the job is processed (or cancelled or expired)
+  std::future<UVisionResult> result;
+
+public:
+  UVisionJob(UVisionJobType jobType, const UVisionOptions &opt)
+  {
+    type = jobType;
+    options = opt;
+    submitTime.now();
+    result = promise.get_future();
+  }
+  /** cancel job - it is then finished with status CANCELLED */
+  void cancel()
+  {
+    cancelled = true;
+  }
+  /** test (without waiting) if the result is available */
+  bool isReady()
+  {
+    return result.valid() and
+           result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+  /**
+   * Get result, waits for the result if not ready
+   * the result can be fetched once only */
+  UVisionResult get()
+  {
+    return result.get();
+  }
+
+protected:
+  friend class UCamera;
+  /** finish job with this result (camera thread only) */
+  void finish(UVisionResult &res)
+  {
+    res.waitTime = res.imTime - submitTime;
+    promise.set_value(res);
+  }
+  /** finish job without an image */
+  void finish(UVisionResult::Status status)
+  {
+    UVisionResult res;
+    res.status = status;
+    promise.set_value(res);
+  }
+  //
+  UTime submitTime;
+  std::atomic<bool> cancelled{false};
+  std::promise<UVisionResult> promise;
+};
+
+typedef std::shared_ptr<UVisionJob> UVisionJobPtr;
+
+#endif
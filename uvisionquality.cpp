@@ -0,0 +1,148 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include <cmath>
+#include "uvisionquality.h"
+
+UVisionQuality::UVisionQuality()
+{ // blur, morph, detector scale, servo every, aruco every, roi top
+  levels[0] = {11, 15, 0.5, 1, 1, 0.0};
+  levels[1] = {7, 11, 0.5, 1, 2, 0.0};
+  levels[2] = {5, 9, 0.35, 2, 2, 0.3};
+  levels[3] = {5, 7, 0.25, 3, 4, 0.4};
+}
+
+UVisionQuality::~UVisionQuality()
+{
+  closeLog();
+}
+
+void UVisionQuality::openLog(const char *date)
+{
+  const int MNL = 100;
+  char name[MNL];
+  snprintf(name, MNL, "vision_quality_%s.txt", date);
+  log = fopen(name, "w");
+  if (log != NULL)
+  {
+    fprintf(log, "%% vision quality changes (budget %.0f ms per frame)\n", budget * 1000);
+    fprintf(log, "%% 1 frame number\n");
+    fprintf(log, "%% 2 new quality level (0 is full quality)\n");
+    fprintf(log, "%% 3 filtered processing time [ms]\n");
+    fprintf(log, "%% 4 SoC temperature [deg C]\n");
+    fprintf(log, "%% 5 CPU frequency [MHz]\n");
+    fprintf(log, "%% 6 reason\n");
+    fflush(log);
+  }
+  else
+    printf("# UVisionQuality:: failed to open %s\n", name);
+}
+
+void UVisionQuality::closeLog()
+{
+  if (log != NULL)
+  {
+    fclose(log);
+    log = NULL;
+  }
+}
+
+void UVisionQuality::readSoc()
+{
+  FILE *f = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
+  if (f != NULL)
+  { // milli degrees
+    int v;
+    if (fscanf(f, "%d", &v) == 1)
+      socTemp = v / 1000.0;
+    fclose(f);
+  }
+  f = fopen("/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq", "r");
+  if (f != NULL)
+  { // kHz
+    int v;
+    if (fscanf(f, "%d", &v) == 1)
+      socFreq = v / 1000.0;
+    fclose(f);
+  }
+}
+
+void UVisionQuality::setLevel(int newLevel, int frame, const char *why)
+{
+  if (newLevel < 0 or newLevel >= LEVEL_CNT or newLevel == level)
+    return;
+  level = newLevel;
+  changeCnt++;
+  overCnt = 0;
+  underCnt = 0;
+  if (log != NULL)
+  {
+    fprintf(log, "%d %d %.1f %.1f %.0f %s\n", frame, level, avgTime * 1000, socTemp, socFreq, why);
+    fflush(log);
+  }
+}
+
+void UVisionQuality::frameDone(float processTime, int frame)
+{
+  frameCnt++;
+  if (processTime > budget)
+    missCnt++;
+  if (processTime > maxTime)
+    maxTime = processTime;
+  avgTime = avgTime * 0.8 + processTime * 0.2;
+  if (not socRead or socReadTime.getTimePassed() > 1.0)
+  {
+    readSoc();
+    socReadTime.now();
+    socRead = true;
+  }
+  if (socTemp > hotTemp and level == 0)
+    setLevel(1, frame, "hot");
+  else if (avgTime > budget)
+  { // shed load if over budget for some frames
+    overCnt++;
+    underCnt = 0;
+    if (overCnt >= 5)
+      setLevel(level + 1, frame, "over budget");
+  }
+  else if (avgTime < budget * 0.6 and (socTemp < hotTemp or level > 1))
+  { // restore quality after a longer period with headroom
+    underCnt++;
+    overCnt = 0;
+    if (underCnt >= 30)
+      setLevel(level - 1, frame, "headroom");
+  }
+  else
+  {
+    overCnt = 0;
+    underCnt = 0;
+  }
+}
+
+void UVisionQuality::printStatus()
+{
+  printf("# vision quality: level %d of %d, %d level changes\n", level, LEVEL_CNT - 1, changeCnt);
+  printf("#   %d frames, %d over %.0f ms budget, filtered %.1f ms, max %.1f ms\n",
+         frameCnt, missCnt, budget * 1000, avgTime * 1000, maxTime * 1000);
+  printf("#   SoC temperature %.1f C, CPU frequency %.0f MHz\n", socTemp, socFreq);
+  const UQualityLevel &k = levels[level];
+  printf("#   blur %d, morph %d, detector scale %.2f, servo every %d, ArUco every %d, roi top %.0f%%\n",
+         k.blurKernel, k.morphKernel, k.detectorScale, k.servoEvery, k.arucoEvery, k.roiTop * 100);
+}
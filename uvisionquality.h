@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2016-2020 by DTU (Christian Andersen)                        *
+ *   jca@elektro.dtu.dk                                                    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Lesser General Public License as        *
+ *   published by the Free Software Foundation; either version 2 of the    *
+ *   License, or (at your option) any later version.                       *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Lesser General Public License for more details.                   *
+ *                                                                         *
+ *   You should have received a copy of the GNU Lesser General Public      *
+ *   License along with this program; if not, write to the                 *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef UVISIONQUALITY_H
+#define UVISIONQUALITY_H
+
+#include <cstdio>
+#include "utime.h"
+
+/**
+ * Vision settings for one quality level */
+struct UQualityLevel
+{
+  /// ball detection median and Gaussian blur kernel size (odd)
+  int blurKernel;
+  /// ball detection morphology (open) kernel size
+  int morphKernel;
+  /// object detector image reduction
+  float detectorScale;
+  /// ball servo detection on every n'th frame
+  int servoEvery;
+  /// ArUco jobs on every n'th frame
+  int arucoEvery;
+  /// part of image (from top) not searched for balls (above floor)
+  float roiTop;
+};
+
+/**
+ * Deadline tracking and adaptive quality for the camera thread.
+ * Processing time of each frame is compared to a budget, when the (filtered)
+ * time exceeds the budget, the quality level is lowered (cheaper settings),
+ * when there is headroom again, quality is restored.
+ * The SoC temperature and CPU frequency are read every second, a hot SoC
+ * (that will soon throttle) lowers quality too.
+ * All level changes are logged to vision_quality_[date].txt. */
+class UVisionQuality
+{
+public:
+  /// processing time allowed per frame [sec]
+  float budget = 0.1;
+  /// SoC temperature where quality is lowered [deg C]
+  float hotTemp = 80;
+  const static int LEVEL_CNT = 4;
+
+public:
+  /** Constructor */
+  UVisionQuality();
+  /** destructor */
+  ~UVisionQuality();
+  /**
+   * A frame is processed
+   * \param processTime is time from image capture to processing is finished [sec]
+   * \param frame is the image number */
+  void frameDone(float processTime, int frame);
+  /** settings for current quality level */
+  const UQualityLevel &knobs()
+  {
+    return levels[level];
+  }
+  int getLevel()
+  {
+    return level;
+  }
+  /** open log with this date string */
+  void openLog(const char *date);
+  void closeLog();
+  /** print status */
+  void printStatus();
+
+private:
+  /** read SoC temperature and CPU frequency */
+  void readSoc();
+  /** change level and log why */
+  void setLevel(int newLevel, int frame, const char *why);
+  //
+  UQualityLevel levels[LEVEL_CNT];
+  int level = 0;
+  /// filtered processing time [sec]
+  float avgTime = 0;
+  float maxTime = 0;
+  int overCnt = 0, underCnt = 0;
+  int frameCnt = 0, missCnt = 0, changeCnt = 0;
+  /// SoC temperature [deg C] and frequency [MHz], -1 if not available
+  float socTemp = -1, socFreq = -1;
+  UTime socReadTime;
+  bool socRead = false;
+  FILE *log = NULL;
+};
+
+#endif